@@ -0,0 +1,63 @@
+#!/bin/bash
+# Stage handoff benchmark: the same pipeline unpinned, with --cpus=auto, as
+# tasks on one pool thread and on the reader thread alone. For every run, the binary trace gives the time from one stage forwarding an
+# item to the next stage taking it; the spread of that latency over repeated
+# runs shows how stable each mode keeps it.
+# Usage: ./bench.sh [lines] [runs]   (results also go to bench_output.txt)
+
+LINES=${1:-20000}
+RUNS=${2:-5}
+STAGES="uppercaser flipper expander logger"
+OUT=bench_output.txt
+TRACE=/tmp/analyzer_bench.trc
+
+if [ ! -x ./output/analyzer ] || [ ! -x ./output/trace_decode ]; then
+  echo "Build first: ./build.sh"
+  exit 1
+fi
+
+INPUT=$(mktemp)
+{ seq 1 "$LINES" | sed 's/$/ the quick brown fox/'; echo "<END>"; } > "$INPUT"
+
+# hop latencies (us) from a decoded trace: the i-th "forwarding" of a stage is
+# paired with the i-th "got item" of the stage after it. stages are numbered
+# by their init records, which come in pipeline order (a plugin's trace name
+# need not match its file name)
+hop_latency() {
+  ./output/trace_decode -t "$TRACE" | awk '
+    {
+      line = $0; sub(/^\[ */, "", line); t = line + 0
+      split($0, halves, "] - "); count = split(halves[1], parts, "["); name = parts[count]
+      if ($0 ~ / - Plugin initialized successfully$/) { index_of[name] = ++stages; next }
+      k = index_of[name]
+      if ($0 ~ / - forwarding$/) { fwd[k, sent[k]++] = t }
+      else if ($0 ~ / - got item/ && k > 1) { print t - fwd[k - 1, got[k]++] }
+    }' | sort -n | awk '
+    { v[NR] = $1 }
+    END {
+      if (NR == 0) { print "n/a"; exit }
+      printf "p50 %.1f us  p99 %.1f us  max %.1f us", v[int(NR * 0.5) + 1], v[int(NR * 0.99) + 1], v[NR]
+    }'
+}
+
+run_mode() {
+  local label=$1
+  shift
+  for run in $(seq 1 "$RUNS"); do
+    local start end
+    start=$(date +%s%N)
+    ./output/analyzer --no-fusion --trace="$TRACE" "$@" 64 $STAGES < "$INPUT" > /dev/null
+    end=$(date +%s%N)
+    printf "%-10s run %d: %6d ms  hop %s\n" "$label" "$run" $(( (end - start) / 1000000 )) "$(hop_latency)"
+  done
+}
+
+{
+  echo "Pipeline: $STAGES, $LINES lines, $RUNS runs, $(nproc) CPUs available"
+  run_mode unpinned
+  run_mode auto --cpus=auto
+  run_mode tasks --tasks=1
+  run_mode single --single-thread
+} | tee "$OUT"
+
+rm -f "$INPUT" "$TRACE"
@@ -7,7 +7,10 @@ mkdir -p output
 echo "[BUILD] Compiling main.c"
 gcc -g -O0 -fno-omit-frame-pointer \
     -rdynamic -Wl,-export-dynamic \
-    -o output/analyzer main.c -ldl -lpthread
+    -o output/analyzer main.c plugins/sync/slab_allocator.c plugins/sync/message.c plugins/sync/trace_ring.c plugins/sync/cpu_placement.c plugins/sync/task_pool.c plugins/sync/stage_stats.c -ldl -lpthread
+
+echo "[BUILD] Compiling trace_decode"
+gcc -g -O0 -o output/trace_decode tools/trace_decode.c -Iplugins -Iplugins/sync
 
 PLUGINS="logger typewriter uppercaser rotator flipper expander"
 
@@ -17,8 +20,20 @@ for plugin in $PLUGINS; do
         plugins/${plugin}.c \
         plugins/plugin_common.c \
         plugins/sync/consumer_producer.c\
+        plugins/sync/spsc_ring.c \
+        plugins/sync/mpmc_ring.c \
         plugins/sync/monitor.c \
+        plugins/sync/message.c \
+        plugins/sync/stage_stats.c \
+        plugins/sync/output_sink.c \
         -Iplugins -Iplugins/sync -lpthread
 done
 
+echo "[BUILD] Compiling unit tests"
+mkdir -p output/tests
+SYNC_SOURCES=$(ls plugins/sync/*.c | grep -v '_test\.c$')
+for test in plugins/sync/*_test.c; do
+    gcc -g -O0 -Wall -o output/tests/$(basename "$test" .c) "$test" $SYNC_SOURCES -Iplugins/sync -lpthread
+done
+
 echo "[BUILD] Done."
\ No newline at end of file
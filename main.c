@@ -5,28 +5,381 @@
 #include <dlfcn.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "plugins/plugin_host.h"
+#include "plugins/sync/slab_allocator.h"
+#include "plugins/sync/message.h"
+#include "plugins/sync/trace_ring.h"
+#include "plugins/sync/cpu_placement.h"
+#include "plugins/sync/task_pool.h"
+#include "plugins/sync/stage_stats.h"
 
 typedef const char* (*plugin_init_func_t)(int);
+typedef const char* (*plugin_init_with_host_func_t)(const plugin_host_t*, int);
 typedef const char* (*plugin_place_work_func_t)(const char*);
 typedef void        (*plugin_attach_func_t)(const char* (*)(const char*));
 typedef const char* (*plugin_fini_func_t)(void);
 typedef const char* (*plugin_wait_finished_func_t)(void);
+typedef const char* (*plugin_set_queue_byte_budget_func_t)(size_t);
+typedef const char* (*plugin_instance_create_func_t)(const plugin_host_t*, int, void**);
+typedef const char* (*plugin_instance_create_workers_func_t)(const plugin_host_t*, int, int, void**);
+typedef unsigned    (*plugin_get_capabilities_func_t)(void);
+typedef const char* (*plugin_transform_func_t)(const char*);
+typedef const char* (*plugin_set_host_func_t)(const plugin_host_t*);
+typedef void        (*plugin_transform_inplace_func_t)(char*, size_t);
+typedef message_t*  (*plugin_transform_v2_func_t)(message_t*);
+typedef const char* (*plugin_instance_fuse_func_t)(void*, plugin_transform_func_t, plugin_transform_inplace_func_t, plugin_transform_v2_func_t);
+typedef const char* (*plugin_instance_place_message_func_t)(void*, message_t*);
+typedef void        (*plugin_instance_attach_func_t)(void*, plugin_instance_place_message_func_t, void*);
+typedef const char* (*plugin_instance_func_t)(void*);
+typedef const char* (*plugin_instance_set_queue_byte_budget_func_t)(void*, size_t);
+typedef int         (*plugin_instance_try_place_message_func_t)(void*, message_t*);
+typedef void        (*plugin_instance_park_producer_func_t)(void*, void (*)(void*), void*);
+typedef void        (*plugin_instance_attach_task_func_t)(void*, plugin_instance_try_place_message_func_t, plugin_instance_park_producer_func_t);
 
 typedef struct {
     plugin_init_func_t init;
+    plugin_init_with_host_func_t init_with_host; /* optional, may be NULL */
     plugin_fini_func_t fini;
     plugin_place_work_func_t place_work;
     plugin_attach_func_t attach;
     plugin_wait_finished_func_t wait_finished;
+    plugin_set_queue_byte_budget_func_t set_queue_byte_budget; /* optional, may be NULL */
+    //instance ABI, used when every plugin exports it
+    plugin_instance_create_func_t instance_create;
+    plugin_instance_create_workers_func_t instance_create_workers; /* optional, may be NULL */
+    plugin_instance_place_message_func_t instance_place_message;
+    plugin_instance_attach_func_t instance_attach;
+    plugin_instance_func_t instance_wait_finished;
+    plugin_instance_func_t instance_destroy;
+    plugin_instance_set_queue_byte_budget_func_t instance_set_queue_byte_budget;
+    plugin_get_capabilities_func_t get_capabilities; /* optional, may be NULL */
+    //task mode, optional
+    plugin_instance_try_place_message_func_t instance_try_place_message;
+    plugin_instance_park_producer_func_t instance_park_producer; /* may be NULL */
+    plugin_instance_attach_task_func_t instance_attach_task;
+    int task; /* Stage runs as a task on the shared pool instead of its own thread */
+    //fusion, optional
+    plugin_transform_func_t transform;
+    plugin_transform_inplace_func_t transform_inplace; /* may be NULL */
+    plugin_transform_v2_func_t transform_v2; /* may be NULL */
+    plugin_set_host_func_t set_host;
+    plugin_instance_fuse_func_t instance_fuse;
+    int hooks; /* Exports plugin_control or plugin_idle, which only run on the stage's own thread */
+    int fused; /* Stage runs inside the previous stage's thread, no instance of its own */
+    void* instance; /* NULL when the stage has its own namespace instead */
+    int workers; /* Worker threads requested for the stage */
     char* name;
     void* handle;
 } plugin_handle_t;
 
+//message buffers are allocated from the host's slab allocator so that any
+//plugin can free what another one allocated (each plugin namespace has its own
+//libc), and a buffer freed downstream goes back to the stage that made it
+static slab_allocator_t messageAllocator;
+
+static void* host_alloc(size_t size){
+    return slab_alloc(&messageAllocator, size);
+}
+
+static void host_free(void* ptr){
+    slab_free(&messageAllocator, ptr);
+}
+
+//binary trace of the stages' events, written only with --trace=FILE
+static trace_log_t traceLog;
+
+static int host_trace_source(const char* name){
+    return trace_log_source(&traceLog, name);
+}
+
+static void host_trace(int source, int event, uint64_t arg0, uint64_t arg1){
+    trace_log_record(&traceLog, source, event, arg0, arg1);
+}
+
+//per-stage counters and latency histograms, with --stats or --metrics. the
+//--stats table goes to stderr at shutdown and whenever the process gets SIGUSR1
+static stage_stats_t** stageStats;
+static char** stageStatNames;
+static int stageStatCount;
+static int stageStatCap;
+static pthread_mutex_t stageStatLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t statsStart;
+static pthread_t statsThread;
+static sigset_t statsSignals;
+static atomic_int statsStop;
+//--metrics=PATH: a Unix socket that answers each connection with one JSON
+//snapshot of the stages and closes it
+static int metricsSocket = -1;
+static pthread_t metricsThread;
+
+static struct stage_stats* host_stats(const char* name){
+    stage_stats_t* stats = calloc(1, sizeof(stage_stats_t));
+    //the plugin's name string goes away with the plugin
+    char* copy = strdup(name);
+    pthread_mutex_lock(&stageStatLock);
+    if(stats != NULL && copy != NULL && stageStatCount == stageStatCap){
+        int cap = stageStatCap > 0 ? stageStatCap * 2 : 16;
+        stage_stats_t** grownStats = realloc(stageStats, cap * sizeof(stage_stats_t*));
+        if(grownStats != NULL){
+            stageStats = grownStats;
+        }
+        char** grownNames = realloc(stageStatNames, cap * sizeof(char*));
+        if(grownNames != NULL){
+            stageStatNames = grownNames;
+        }
+        if(grownStats != NULL && grownNames != NULL){
+            stageStatCap = cap;
+        }
+    }
+    if(stats == NULL || copy == NULL || stageStatCount == stageStatCap){
+        pthread_mutex_unlock(&stageStatLock);
+        free(stats);
+        free(copy);
+        return NULL;
+    }
+    stageStats[stageStatCount] = stats;
+    stageStatNames[stageStatCount] = copy;
+    stageStatCount++;
+    pthread_mutex_unlock(&stageStatLock);
+    return stats;
+}
+
+static void print_stage_stats(void){
+    pthread_mutex_lock(&stageStatLock);
+    double seconds = (stage_stats_now() - statsStart) / 1e9;
+    stage_stats_report(stderr, (const char* const*)stageStatNames, stageStats, stageStatCount, seconds);
+    pthread_mutex_unlock(&stageStatLock);
+}
+
+//SIGUSR1 is blocked in every thread, so it only ever arrives here
+static void* stats_signal_thread(void* arg){
+    (void)arg;
+    int sig;
+    while(sigwait(&statsSignals, &sig) == 0 && !atomic_load(&statsStop)){
+        print_stage_stats();
+    }
+    return NULL;
+}
+
+static void stats_start(void){
+    //block before any other thread exists: they all inherit the mask
+    sigemptyset(&statsSignals);
+    sigaddset(&statsSignals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &statsSignals, NULL);
+    if(pthread_create(&statsThread, NULL, stats_signal_thread, NULL) != 0){
+        fprintf(stderr, "Failed to start stats thread\n");
+        exit(2);
+    }
+}
+
+static void stats_stop(void){
+    atomic_store(&statsStop, 1);
+    pthread_kill(statsThread, SIGUSR1);
+    pthread_join(statsThread, NULL);
+    print_stage_stats();
+    //stage threads add their CPU as they end, so this table waits until now
+    double seconds = (stage_stats_now() - statsStart) / 1e9;
+    stage_stats_cpu_report(stderr, (const char* const*)stageStatNames, stageStats, stageStatCount, seconds);
+}
+
+static void stats_free(void){
+    for(int i = 0; i < stageStatCount; i++){
+        free(stageStats[i]);
+        free(stageStatNames[i]);
+    }
+    free(stageStats);
+    free(stageStatNames);
+}
+
+static void print_json_string(FILE* out, const char* text){
+    fputc('"', out);
+    for(const unsigned char* p = (const unsigned char*)text; *p != '\0'; p++){
+        if(*p == '"' || *p == '\\'){
+            fprintf(out, "\\%c", *p);
+        }else if(*p < 0x20){
+            fprintf(out, "\\u%04x", *p);
+        }else{
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+//a stage is blocked on full while it is parked putting into the next stage's
+//queue, and waiting on empty while parked on its own. stages run as tasks
+//never park, so they always show as running
+static void write_metrics(FILE* out){
+    pthread_mutex_lock(&stageStatLock);
+    stage_queue_sample_t samples[stageStatCount + 1];
+    for(int i = 0; i < stageStatCount; i++){
+        memset(&samples[i], 0, sizeof(stage_queue_sample_t));
+        void* queue = atomic_load_explicit(&stageStats[i]->queue, memory_order_acquire);
+        if(queue != NULL){
+            stageStats[i]->sample_queue(queue, &samples[i]);
+        }
+    }
+    fprintf(out, "{\"uptime_s\":%.3f,\"reader\":\"%s\",\"stages\":[", (stage_stats_now() - statsStart) / 1e9,
+            stageStatCount > 0 && samples[0].waiting_producers > 0 ? "blocked on full" : "running");
+    for(int i = 0; i < stageStatCount; i++){
+        stage_stats_t* s = stageStats[i];
+        const char* state = "running";
+        if(i + 1 < stageStatCount && samples[i + 1].waiting_producers > 0){
+            state = "blocked on full";
+        }else if(samples[i].waiting_consumers > 0){
+            state = "waiting on empty";
+        }
+        fprintf(out, "%s\n{\"name\":", i > 0 ? "," : "");
+        print_json_string(out, stageStatNames[i]);
+        fprintf(out, ",\"queue_depth\":%d,\"queue_capacity\":%d,\"queue_bytes\":%zu,\"items_in\":%llu,\"items_out\":%llu,"
+                "\"bytes_in\":%llu,\"bytes_out\":%llu,\"state\":\"%s\"}",
+                samples[i].depth, samples[i].capacity, samples[i].bytes,
+                (unsigned long long)atomic_load_explicit(&s->items_in, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&s->items_out, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&s->bytes_in, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&s->bytes_out, memory_order_relaxed), state);
+    }
+    fprintf(out, "\n]}\n");
+    pthread_mutex_unlock(&stageStatLock);
+}
+
+static void* metrics_thread(void* arg){
+    (void)arg;
+    while(1){
+        int client = accept(metricsSocket, NULL, NULL);
+        if(client < 0){
+            //metrics_stop shuts the socket down, which ends the wait here
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            break;
+        }
+        char* text = NULL;
+        size_t length = 0;
+        FILE* out = open_memstream(&text, &length);
+        if(out != NULL){
+            write_metrics(out);
+            fclose(out);
+            //a client that hangs up early must not kill us with SIGPIPE
+            for(size_t sent = 0; sent < length;){
+                ssize_t n = send(client, text + sent, length - sent, MSG_NOSIGNAL);
+                if(n <= 0){
+                    break;
+                }
+                sent += (size_t)n;
+            }
+        }
+        free(text);
+        close(client);
+    }
+    return NULL;
+}
+
+static const char* metrics_start(const char* path){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        return "Metrics socket path is too long";
+    }
+    strcpy(addr.sun_path, path);
+    //a socket left behind by an earlier run is replaced, anything else is not
+    struct stat st;
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)){
+        unlink(path);
+    }
+    metricsSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(metricsSocket < 0){
+        return "Failed to create metrics socket";
+    }
+    if(bind(metricsSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(metricsSocket, 8) != 0){
+        close(metricsSocket);
+        metricsSocket = -1;
+        return "Failed to listen on metrics socket";
+    }
+    if(pthread_create(&metricsThread, NULL, metrics_thread, NULL) != 0){
+        close(metricsSocket);
+        metricsSocket = -1;
+        unlink(path);
+        return "Failed to start metrics thread";
+    }
+    return NULL;
+}
+
+//before the stages go away: the snapshot reads their queues
+static void metrics_stop(const char* path){
+    shutdown(metricsSocket, SHUT_RDWR);
+    pthread_join(metricsThread, NULL);
+    close(metricsSocket);
+    metricsSocket = -1;
+    unlink(path);
+}
+
+//CPUs for the reader and the stage threads, with --cpus or ANALYZER_CPUS
+static cpu_placement_t cpuPlacement;
+
+static int host_thread_cpu(void){
+    return cpu_placement_next(&cpuPlacement);
+}
+
+//with --tasks, stages that never wait run as tasks on this pool; they get
+//taskHost (host plus schedule) instead of host. with --single-thread the
+//pool has no threads and the reader runs every stage's task itself
+static task_pool_t taskPool;
+static plugin_host_t taskHost;
+
+static void host_schedule(void (*run)(void*), void* arg, int later){
+    task_pool_submit(&taskPool, run, arg, later);
+}
+
+// a stage that can run as a task on the shared pool
+int can_run_as_task(const plugin_handle_t* plugin){
+    unsigned caps = plugin->get_capabilities ? plugin->get_capabilities() : 0;
+    return (caps & PLUGIN_CAP_NONBLOCKING) && plugin->workers == 1 && plugin->instance_attach_task;
+}
+
+//the trace and placement entries are filled in when requested
+static plugin_host_t host = {
+    .alloc = host_alloc,
+    .free = host_free,
+};
+
 void print_helper(){
-    printf("Usage: ./analyzer <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
+    printf("Usage: ./analyzer [options] <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
     printf("Arguments:\n");
     printf("  queue_size    Maximum number of items in each plugin's queue\n");
     printf("  plugin1..N    Names of plugins to load (without .so extension)\n");
+    printf("                name:N runs N workers on a stateless stage, output stays in order\n");
+    printf("Options:\n");
+    printf("  --queue-bytes=N   Also bound each plugin's queue by N payload bytes (K/M/G suffixes allowed)\n");
+    printf("  --arena=N         Preallocate N bytes for message buffers (K/M/G suffixes allowed)\n");
+    printf("  --no-fusion       Give every stage its own queue and thread, even cheap stateless ones\n");
+    printf("  --isolate         Load every stage into its own linker namespace (single-instance plugins)\n");
+    printf("  --hugepages       Back message buffer arenas with huge pages when available\n");
+    printf("  --trace=FILE      Record stage events in binary form to FILE (read it with trace_decode)\n");
+    printf("  --tasks[=N]       Run stages that never wait as tasks on N threads (default: one per CPU)\n");
+    printf("                    instead of a thread per stage\n");
+    printf("  --single-thread   Run every stage on the reader thread, each line all the way down the\n");
+    printf("                    pipeline before the next is read\n");
+    printf("  --stats           Count items and time each stage; the table goes to stderr at exit\n");
+    printf("                    and on SIGUSR1. At exit a second table gives each stage's CPU time\n");
+    printf("                    per item (and cycles per item where hardware counters are available)\n");
+    printf("  --metrics=PATH    Serve a JSON snapshot of every stage (queue depth and capacity, items and\n");
+    printf("                    bytes, whether it is blocked on a full queue or waiting on an empty one)\n");
+    printf("                    to each client of the Unix socket PATH\n");
+    printf("  --cpus=LIST|auto  Pin the reader and then each stage thread to these CPUs in order (e.g. 0,2,4-7);\n");
+    printf("                    auto puts adjacent stages on sibling cores of one socket\n");
+    printf("Environment:\n");
+    printf("  ANALYZER_LOG_LEVEL  Plugin log verbosity on stderr: error, warn (default), info or debug\n");
+    printf("  ANALYZER_CPUS       Same as --cpus, used when the option is not given\n");
     printf("Available plugins:\n");
     printf("  logger        - Logs all strings that pass through\n");
     printf("  typewriter    - Simulates typewriter effect with delays\n");
@@ -40,110 +393,479 @@ void print_helper(){
     printf("  echo '<END>' | ./analyzer 20 uppercaser rotator logger\n");
 
 }
+// parse a byte count such as 65536, 64K, 16M or 1G
+int parse_bytes(const char* text, size_t* out){
+    //strtoull would take "-1" as ULLONG_MAX (and skip spaces): digits only
+    if(*text < '0' || *text > '9'){
+        return -1;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if(errno == ERANGE){
+        return -1;
+    }
+    int shift = 0;
+    switch(*end){
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+    }
+    if(*end != '\0' || value == 0 || value > (SIZE_MAX >> shift)){
+        return -1;
+    }
+    *out = (size_t)value << shift;
+    return 0;
+}
+
+// load every stage through the instance ABI: each .so is opened once in our
+// own namespace (dlopen returns the same handle for a repeated name) and each
+// stage gets an instance of it. Returns 0, with nothing left open, if any
+// plugin is missing or lacks the instance ABI
+int load_plugin_instances(plugin_handle_t* plugins, char** names, int count){
+    for(int i = 0; i < count; i++){
+        char fileName[256];
+        snprintf(fileName, sizeof(fileName), "output/%s.so", names[i]);
+        void* handle = dlopen(fileName, RTLD_NOW | RTLD_LOCAL);
+        plugin_handle_t plugin = {0};
+        if(handle){
+            plugin.instance_create = (plugin_instance_create_func_t)dlsym(handle, "plugin_instance_create");
+            plugin.instance_create_workers = (plugin_instance_create_workers_func_t)dlsym(handle, "plugin_instance_create_workers");
+            plugin.instance_place_message = (plugin_instance_place_message_func_t)dlsym(handle, "plugin_instance_place_message");
+            plugin.instance_attach = (plugin_instance_attach_func_t)dlsym(handle, "plugin_instance_attach");
+            plugin.instance_wait_finished = (plugin_instance_func_t)dlsym(handle, "plugin_instance_wait_finished");
+            plugin.instance_destroy = (plugin_instance_func_t)dlsym(handle, "plugin_instance_destroy");
+            plugin.instance_set_queue_byte_budget = (plugin_instance_set_queue_byte_budget_func_t)dlsym(handle, "plugin_instance_set_queue_byte_budget");
+        }
+        if(!handle || !plugin.instance_create || !plugin.instance_place_message || !plugin.instance_attach
+           || !plugin.instance_wait_finished || !plugin.instance_destroy || !plugin.instance_set_queue_byte_budget){
+            if(handle){
+                dlclose(handle);
+            }
+            for(int j = 0; j < i; j++){
+                dlclose(plugins[j].handle);
+                free(plugins[j].name);
+            }
+            return 0;
+        }
+        plugin.get_capabilities = (plugin_get_capabilities_func_t)dlsym(handle, "plugin_get_capabilities");
+        plugin.instance_try_place_message = (plugin_instance_try_place_message_func_t)dlsym(handle, "plugin_instance_try_place_message");
+        plugin.instance_park_producer = (plugin_instance_park_producer_func_t)dlsym(handle, "plugin_instance_park_producer");
+        plugin.instance_attach_task = (plugin_instance_attach_task_func_t)dlsym(handle, "plugin_instance_attach_task");
+        plugin.transform = (plugin_transform_func_t)dlsym(handle, "plugin_transform");
+        plugin.transform_inplace = (plugin_transform_inplace_func_t)dlsym(handle, "plugin_transform_inplace");
+        plugin.transform_v2 = (plugin_transform_v2_func_t)dlsym(handle, "plugin_transform_v2");
+        plugin.set_host = (plugin_set_host_func_t)dlsym(handle, "plugin_set_host");
+        plugin.instance_fuse = (plugin_instance_fuse_func_t)dlsym(handle, "plugin_instance_fuse");
+        plugin.hooks = dlsym(handle, "plugin_control") != NULL || dlsym(handle, "plugin_idle") != NULL;
+        plugin.name = strdup(names[i]);
+        plugin.handle = handle;
+        plugins[i] = plugin;
+    }
+    return 1;
+}
+
+// a stage that can run inside another stage's thread
+int can_fuse(const plugin_handle_t* plugin){
+    unsigned caps = plugin->get_capabilities ? plugin->get_capabilities() : 0;
+    return (caps & PLUGIN_CAP_FUSABLE) && plugin->transform && plugin->set_host && plugin->instance_fuse;
+}
+
+// plugin may run inside head's thread(s). a fused stage only gets its
+// transform called, so a plugin with control/idle hooks keeps its own stage;
+// behind a worker pool it runs on every worker at once, so it must be stateless
+int can_fuse_behind(const plugin_handle_t* head, const plugin_handle_t* plugin){
+    if(!can_fuse(head) || !can_fuse(plugin) || plugin->hooks || plugin->workers != 1){
+        return 0;
+    }
+    unsigned caps = plugin->get_capabilities();
+    return head->workers == 1 || (caps & PLUGIN_CAP_STATELESS);
+}
+
 int main(int argc, char* argv[]){
-    if(argc <= 2){
+    size_t queueBytes = 0;
+    size_t arenaBytes = 0;
+    int hugePages = 0;
+    int isolate = 0;
+    int fusion = 1;
+    const char* tracePath = NULL;
+    const char* cpuSpec = getenv("ANALYZER_CPUS");
+    int taskThreads = 0;
+    int singleThread = 0;
+    int stats = 0;
+    const char* metricsPath = NULL;
+    //options come before <queue_size>
+    int argi = 1;
+    while(argi < argc && strncmp(argv[argi], "--", 2) == 0){
+        if(strncmp(argv[argi], "--queue-bytes=", 14) == 0){
+            if(parse_bytes(argv[argi] + 14, &queueBytes) != 0){
+                fprintf(stderr, "Queue byte budget is not valid\n");
+                print_helper();
+                exit(1);
+            }
+        }else if(strncmp(argv[argi], "--arena=", 8) == 0){
+            if(parse_bytes(argv[argi] + 8, &arenaBytes) != 0){
+                fprintf(stderr, "Arena size is not valid\n");
+                print_helper();
+                exit(1);
+            }
+        }else if(strcmp(argv[argi], "--hugepages") == 0){
+            hugePages = 1;
+        }else if(strcmp(argv[argi], "--isolate") == 0){
+            isolate = 1;
+        }else if(strcmp(argv[argi], "--no-fusion") == 0){
+            fusion = 0;
+        }else if(strncmp(argv[argi], "--trace=", 8) == 0 && argv[argi][8] != '\0'){
+            tracePath = argv[argi] + 8;
+        }else if(strcmp(argv[argi], "--tasks") == 0){
+            taskThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if(taskThreads < 1){
+                taskThreads = 1;
+            }
+        }else if(strncmp(argv[argi], "--tasks=", 8) == 0){
+            taskThreads = atoi(argv[argi] + 8);
+            if(taskThreads < 1){
+                fprintf(stderr, "Task thread count is not valid\n");
+                print_helper();
+                exit(1);
+            }
+        }else if(strcmp(argv[argi], "--stats") == 0){
+            stats = 1;
+        }else if(strncmp(argv[argi], "--metrics=", 10) == 0 && argv[argi][10] != '\0'){
+            metricsPath = argv[argi] + 10;
+        }else if(strcmp(argv[argi], "--single-thread") == 0){
+            singleThread = 1;
+        }else if(strncmp(argv[argi], "--cpus=", 7) == 0){
+            cpuSpec = argv[argi] + 7;
+        }else{
+            fprintf(stderr, "Unknown option %s\n", argv[argi]);
+            print_helper();
+            exit(1);
+        }
+        argi++;
+    }
+    if(argc - argi < 2){
         fprintf(stderr, "No arguments were send\n");
         print_helper();
         exit(1);
     }
-    int queueSize = atoi(argv[1]);
+    int queueSize = atoi(argv[argi]);
     if(queueSize == 0){
         fprintf(stderr, "Queue size is not valid\n");
         print_helper();
         exit(1);
     }
-    int pluginCount = argc - 2;
-    plugin_handle_t plugins[pluginCount];
-    //construct the filename by appending .so
-    for(int i = 2; i<argc; i++){
-        char fileName[256];
-        snprintf(fileName, sizeof(fileName), "output/%s.so", argv[i]);
-        void* handle = dlmopen(LM_ID_NEWLM, fileName, RTLD_NOW | RTLD_LOCAL);
-        if(!handle){
-            print_helper();
-            fprintf(stderr, "Failed to load plugin %s: %s\n", argv[i], dlerror());
-            exit(1);
+    if(slab_allocator_init(&messageAllocator, arenaBytes, hugePages) != 0){
+        fprintf(stderr, "Failed to set up message buffer arena\n");
+        exit(2);
+    }
+    if(stats || metricsPath != NULL){
+        statsStart = stage_stats_now();
+        host.stats = host_stats;
+    }
+    if(stats){
+        stats_start();
+    }
+    if(metricsPath != NULL){
+        const char* err = metrics_start(metricsPath);
+        if(err != NULL){
+            fprintf(stderr, "%s: %s\n", err, metricsPath);
+            exit(2);
         }
-        plugin_init_func_t init = (plugin_init_func_t)dlsym(handle, "plugin_init");
-        if(!init){
-            fprintf(stderr,"plugin_init not found %s\n",dlerror());
-            print_helper();
-            exit(1);
+    }
+    if(tracePath != NULL){
+        const char* err = trace_log_open(&traceLog, tracePath);
+        if(err != NULL){
+            fprintf(stderr, "%s: %s\n", err, tracePath);
+            exit(2);
         }
-        plugin_place_work_func_t placeWorkFunc = (plugin_place_work_func_t)dlsym(handle, "plugin_place_work");
-        if(!placeWorkFunc){
-            fprintf(stderr,"plugin_place_work not found %s\n",dlerror());
+        host.trace_source = host_trace_source;
+        host.trace = host_trace;
+    }
+    if(cpuSpec != NULL && cpuSpec[0] != '\0'){
+        const char* err = cpu_placement_init(&cpuPlacement, cpuSpec);
+        if(err != NULL){
+            fprintf(stderr, "%s: %s\n", err, cpuSpec);
             print_helper();
             exit(1);
         }
-        plugin_attach_func_t attachFunc = (plugin_attach_func_t)dlsym(handle, "plugin_attach");
-        if(!attachFunc){
-            fprintf(stderr,"plugin_attach not found %s\n",dlerror());
-            print_helper();
-            exit(1);
+        //the reader takes the first CPU, stage threads follow in stage order
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_placement_next(&cpuPlacement), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        host.thread_cpu = host_thread_cpu;
+    }
+    int firstPlugin = argi + 1;
+    int pluginCount = argc - firstPlugin;
+    plugin_handle_t plugins[pluginCount];
+    //a stage may ask for workers as name:N; cut the suffix off the name
+    int stageWorkers[pluginCount];
+    for(int i = firstPlugin; i < argc; i++){
+        stageWorkers[i - firstPlugin] = 1;
+        char* colon = strchr(argv[i], ':');
+        if(colon != NULL){
+            *colon = '\0';
+            stageWorkers[i - firstPlugin] = atoi(colon + 1);
+            if(stageWorkers[i - firstPlugin] < 1){
+                fprintf(stderr, "Worker count of %s is not valid\n", argv[i]);
+                print_helper();
+                exit(1);
+            }
         }
-        plugin_fini_func_t finiFunc = (plugin_fini_func_t)dlsym(handle, "plugin_fini");
-        if(!finiFunc){
-            fprintf(stderr,"plugin_fini not found %s\n",dlerror());
-            print_helper();
-            exit(1);
+    }
+    //one loaded .so serves every stage that names it; plugins without the
+    //instance ABI fall back to a private namespace (and libc) per stage
+    int instanceMode = !isolate && load_plugin_instances(plugins, argv + firstPlugin, pluginCount);
+    if(!instanceMode){
+        //construct the filename by appending .so
+        for(int i = firstPlugin; i<argc; i++){
+            char fileName[256];
+            snprintf(fileName, sizeof(fileName), "output/%s.so", argv[i]);
+            void* handle = dlmopen(LM_ID_NEWLM, fileName, RTLD_NOW | RTLD_LOCAL);
+            if(!handle){
+                print_helper();
+                fprintf(stderr, "Failed to load plugin %s: %s\n", argv[i], dlerror());
+                exit(1);
+            }
+            plugin_init_func_t init = (plugin_init_func_t)dlsym(handle, "plugin_init");
+            if(!init){
+                fprintf(stderr,"plugin_init not found %s\n",dlerror());
+                print_helper();
+                exit(1);
+            }
+            plugin_place_work_func_t placeWorkFunc = (plugin_place_work_func_t)dlsym(handle, "plugin_place_work");
+            if(!placeWorkFunc){
+                fprintf(stderr,"plugin_place_work not found %s\n",dlerror());
+                print_helper();
+                exit(1);
+            }
+            plugin_attach_func_t attachFunc = (plugin_attach_func_t)dlsym(handle, "plugin_attach");
+            if(!attachFunc){
+                fprintf(stderr,"plugin_attach not found %s\n",dlerror());
+                print_helper();
+                exit(1);
+            }
+            plugin_fini_func_t finiFunc = (plugin_fini_func_t)dlsym(handle, "plugin_fini");
+            if(!finiFunc){
+                fprintf(stderr,"plugin_fini not found %s\n",dlerror());
+                print_helper();
+                exit(1);
+            }
+            plugin_wait_finished_func_t waitFinishedFunc = (plugin_wait_finished_func_t)dlsym(handle, "plugin_wait_finished");
+            if(!waitFinishedFunc){
+                fprintf(stderr,"plugin_wait_finished not found %s\n",dlerror());
+                print_helper();
+                exit(1);
+            }
+            plugin_handle_t plugin = {0};
+            plugin.init = init;
+            plugin.place_work = placeWorkFunc;
+            plugin.attach = attachFunc;
+            plugin.fini = finiFunc;
+            plugin.wait_finished = waitFinishedFunc;
+            plugin.init_with_host = (plugin_init_with_host_func_t)dlsym(handle, "plugin_init_with_host");
+            plugin.set_queue_byte_budget = (plugin_set_queue_byte_budget_func_t)dlsym(handle, "plugin_set_queue_byte_budget");
+            if(queueBytes > 0 && !plugin.set_queue_byte_budget){
+                fprintf(stderr,"plugin_set_queue_byte_budget not found in %s\n", argv[i]);
+                print_helper();
+                exit(1);
+            }
+            plugin.get_capabilities = (plugin_get_capabilities_func_t)dlsym(handle, "plugin_get_capabilities");
+            plugin.name = strdup(argv[i]);
+            plugin.handle = handle;
+            plugins[i - firstPlugin] = plugin;
         }
-        plugin_wait_finished_func_t waitFinishedFunc = (plugin_wait_finished_func_t)dlsym(handle, "plugin_wait_finished");
-        if(!waitFinishedFunc){
-            fprintf(stderr,"plugin_wait_finished not found %s\n",dlerror());
-            print_helper();
-            exit(1);
+    }
+    //buffers can only move between stages without copies if every stage
+    //follows the host ownership contract; otherwise everyone copies
+    int zeroCopy = 1;
+    for(int i = 0; !instanceMode && i < pluginCount; i++){
+        if(plugins[i].init_with_host == NULL){
+            zeroCopy = 0;
         }
-        plugin_handle_t plugin;
-        plugin.init = init;
-        plugin.place_work = placeWorkFunc;
-        plugin.attach = attachFunc;
-        plugin.fini = finiFunc;
-        plugin.wait_finished = waitFinishedFunc;
-        plugin.name = strdup(argv[i]);
-        plugin.handle = handle;
-        plugins[i - 2] = plugin;
+    }
+    //only stateless stages loaded as instances can run replicated
+    for(int i = 0; i < pluginCount; i++){
+        plugins[i].workers = stageWorkers[i];
+        if(plugins[i].workers > 1){
+            unsigned caps = plugins[i].get_capabilities ? plugins[i].get_capabilities() : 0;
+            if(!instanceMode || singleThread || !plugins[i].instance_create_workers || !(caps & PLUGIN_CAP_STATELESS)){
+                fprintf(stderr, "Plugin %s cannot run replicated, using one worker\n", plugins[i].name);
+                plugins[i].workers = 1;
+            }
+        }
+    }
+    //stages that never wait share a few pool threads; the rest (and
+    //replicated stages) keep threads of their own
+    int taskCount = 0;
+    for(int i = 0; i < pluginCount; i++){
+        plugins[i].task = instanceMode && taskThreads > 0 && can_run_as_task(&plugins[i]);
+        if(singleThread){
+            //on one thread nothing else waits for a stage: even one that
+            //sleeps can run as a task, it only delays the lines behind it
+            if(!instanceMode || !plugins[i].instance_attach_task || !plugins[i].instance_try_place_message){
+                fprintf(stderr, "Plugin %s cannot run single-threaded\n", plugins[i].name);
+                exit(1);
+            }
+            plugins[i].task = 1;
+        }
+        taskCount += plugins[i].task;
+    }
+    if(taskCount > 0){
+        const char* err = task_pool_init(&taskPool, singleThread ? 0 : taskThreads, host.thread_cpu);
+        if(err != NULL){
+            fprintf(stderr, "Failed to start task pool: %s\n", err);
+            exit(2);
+        }
+        taskHost = host;
+        taskHost.schedule = host_schedule;
     }
     //initialize all the plugins 
+    int head = -1; //stage whose thread the current run of fused stages uses
     for(int i =0; i<pluginCount; i++){
-        const char* err = plugins[i].init(queueSize);
+        const char* err;
+        plugins[i].fused = 0;
+        //a cheap stateless stage right after another one runs on that
+        //stage's thread: no queue, no handoff, no extra thread
+        if(instanceMode && fusion && head >= 0 && can_fuse_behind(&plugins[head], &plugins[i])
+           && plugins[i].set_host(&host) == NULL
+           && plugins[head].instance_fuse(plugins[head].instance, plugins[i].transform, plugins[i].transform_inplace, plugins[i].transform_v2) == NULL){
+            plugins[i].fused = 1;
+            continue;
+        }
+        head = i;
+        if(instanceMode && plugins[i].workers > 1){
+            err = plugins[i].instance_create_workers(&host, queueSize, plugins[i].workers, &plugins[i].instance);
+        }else if(instanceMode){
+            err = plugins[i].instance_create(plugins[i].task ? &taskHost : &host, queueSize, &plugins[i].instance);
+        }else{
+            err = zeroCopy ? plugins[i].init_with_host(&host, queueSize) : plugins[i].init(queueSize);
+        }
         if (err != NULL) {
             fprintf(stderr, "Failed to initialize plugin %s\n", plugins[i].name);
             exit(2);
         }
+        if(queueBytes > 0){
+            err = instanceMode ? plugins[i].instance_set_queue_byte_budget(plugins[i].instance, queueBytes)
+                               : plugins[i].set_queue_byte_budget(queueBytes);
+        }
+        if(err != NULL){
+            fprintf(stderr, "Failed to set queue byte budget of plugin %s\n", plugins[i].name);
+            exit(2);
+        }
     }
-    //step 4: attach plugins together
+    //step 4: attach plugins together, skipping fused stages
     for(int i= 0; i<pluginCount-1;i++){
-        plugins[i].attach(plugins[i+1].place_work);
+        int next = i + 1;
+        while(next < pluginCount && plugins[next].fused){
+            next++;
+        }
+        if(plugins[i].fused || next == pluginCount){
+            continue;
+        }
+        if(instanceMode){
+            plugins[i].instance_attach(plugins[i].instance, plugins[next].instance_place_message, plugins[next].instance);
+            if(plugins[i].task && plugins[next].instance_try_place_message){
+                plugins[i].instance_attach_task(plugins[i].instance, plugins[next].instance_try_place_message, plugins[next].instance_park_producer);
+            }
+        }else{
+            plugins[i].attach(plugins[next].place_work);
+        }
     }
     FILE *in = stdin;
     // If stdin is *not* a terminal (e.g., VS Code launch gave you nothing), fall back to the real tty
-    //Read Input from STDIN
-    char line[1024];
-    while (fgets(line, sizeof(line), stdin)) {
+    //Read Input from STDIN, lines of any length (NUL bytes included)
+    char* line = NULL;
+    size_t lineCap = 0;
+    ssize_t read;
+    while ((read = getline(&line, &lineCap, stdin)) != -1) {
         // Remove trailing newline
-        line[strcspn(line, "\n")] = 0;
-
-        // Duplicate string because place_work takes ownership
-        char* input = strdup(line);
+        size_t length = (size_t)read;
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        int end = length == 5 && memcmp(line, "<END>", 5) == 0;
 
-        plugins[0].place_work(input);
+        if (instanceMode) {
+            //instances take length-carrying messages, nothing is measured again;
+            //the end-of-input line is turned into a control message here, so
+            //no stage ever has to look at payloads to find it
+            message_t* msg = end ? message_control(host_alloc, MESSAGE_END) : message_new(host_alloc, length);
+            if (msg == NULL) {
+                fprintf(stderr, "Failed to allocate input line\n");
+                break;
+            }
+            if (!end) {
+                memcpy(msg->data, line, length + 1);
+                msg->len = length;
+            }
+            if (singleThread) {
+                //a full first queue means running the stages until it has
+                //room; then this line goes all the way down the pipeline
+                while (!plugins[0].instance_try_place_message(plugins[0].instance, msg)) {
+                    task_pool_run_one(&taskPool);
+                }
+                while (task_pool_run_one(&taskPool)) {
+                }
+            } else {
+                plugins[0].instance_place_message(plugins[0].instance, msg);
+            }
+        } else {
+            // Duplicate string: with the host contract place_work takes ownership,
+            // otherwise it copies and we keep ours
+            char* input = host_alloc(length + 1);
+            if (input == NULL) {
+                fprintf(stderr, "Failed to allocate input line\n");
+                break;
+            }
+            memcpy(input, line, length + 1);
+            plugins[0].place_work(input);
+            if (!zeroCopy) {
+                host_free(input);
+            }
+        }
 
-        if (strcmp(line, "<END>") == 0) {
+        if (end) {
             break;
         }
     }
+    free(line);
     for (int i = 0; i < pluginCount; i++) {
-        const char* err = plugins[i].wait_finished();
+        if (plugins[i].fused) {
+            continue;
+        }
+        const char* err = instanceMode ? plugins[i].instance_wait_finished(plugins[i].instance) : plugins[i].wait_finished();
         if (err != NULL) {
             fprintf(stderr, "Error waiting for plugin %s\n", plugins[i].name);
         }
     }
+    if(metricsPath != NULL){
+        metrics_stop(metricsPath);
+    }
+    //every task has run to END; stop the pool before its stages go away
+    if(taskCount > 0){
+        task_pool_destroy(&taskPool);
+    }
     for (int i = 0; i < pluginCount; i++) {
-        plugins[i].fini();
+        if (instanceMode) {
+            //fused stages never had an instance of their own
+            if (!plugins[i].fused) {
+                plugins[i].instance_destroy(plugins[i].instance);
+            }
+        } else {
+            plugins[i].fini();
+        }
         dlclose(plugins[i].handle);
         free(plugins[i].name);
     }
+    if(stats){
+        stats_stop();
+    }
+    stats_free();
+    trace_log_close(&traceLog);
+    cpu_placement_destroy(&cpuPlacement);
+    slab_allocator_destroy(&messageAllocator);
     printf("Pipeline shutdown complete\n");
     return 0;
 }
\ No newline at end of file
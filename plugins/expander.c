@@ -1,13 +1,13 @@
 #include "plugin_common.h"
+#include <string.h>
 const char* plugin_transform(const char* input){
     if(input == NULL){
         return NULL;
     }
     int len = strlen(input);
-    char* result = malloc(len*2+1);
+    char* result = plugin_alloc(len*2+1);
     //somthing went wrong with the malloc
     if (result == NULL) { 
-        free((void*)input);
         return NULL;
     }
     int i = 0;
@@ -25,7 +25,31 @@ const char* plugin_transform(const char* input){
     return result;
 }
 
+__attribute__((visibility("default")))
+message_t* plugin_transform_v2(message_t* input){
+    size_t len = input->len;
+    message_t* result = plugin_message_alloc(len > 0 ? len*2-1 : 0);
+    if (result == NULL) {
+        return NULL;
+    }
+    char* out = result->data;
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0) {
+            *out++ = ' ';
+        }
+        *out++ = input->data[i];
+    }
+    *out = '\0';
+    result->len = out - result->data;
+    return result;
+}
+
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size){
     return common_plugin_init(plugin_transform, "expender", queue_size);
+}
+
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void){
+    return PLUGIN_CAP_STATELESS | PLUGIN_CAP_FUSABLE | PLUGIN_CAP_NONBLOCKING;
 }
\ No newline at end of file
@@ -1,17 +1,92 @@
 #include "plugin_common.h"
+#include "sync/output_sink.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+// Lines go to stdout through one sink per process, shared by every logger
+// stage: a write per buffer of lines instead of one per line
+#define LOGGER_BUFFER_BYTES (64 * 1024)
+// Longest a line waits while more keep coming; once the stage runs out of
+// input (plugin_idle) everything buffered goes out anyway
+#define LOGGER_FLUSH_NS 10000000ull
+
+static output_sink_t sink;
+static pthread_once_t sink_once = PTHREAD_ONCE_INIT;
+static atomic_int sink_ready;
+
+static void sink_open(void){
+    //on a terminal every line shows up as it is logged, the way stdio does it
+    size_t buffer = isatty(STDOUT_FILENO) ? 0 : LOGGER_BUFFER_BYTES;
+    //whatever stdio still holds goes first, so lines stay in order
+    fflush(stdout);
+    sink_ready = output_sink_init(&sink, STDOUT_FILENO, buffer, LOGGER_FLUSH_NS) == NULL;
+}
+
+static void log_line(const char* data, size_t len){
+    pthread_once(&sink_once, sink_open);
+    if(!sink_ready){
+        fputs("[logger] ", stdout);
+        fwrite(data, 1, len, stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+        return;
+    }
+    struct iovec parts[3] = {
+        { "[logger] ", 9 },
+        { (void*)data, len },
+        { "\n", 1 },
+    };
+    output_sink_write(&sink, parts, 3);
+}
+
+//unloading (or exiting) never loses a line, even without an END
+__attribute__((destructor))
+static void sink_close(void){
+    if(sink_ready){
+        output_sink_destroy(&sink);
+        sink_ready = 0;
+    }
+}
+
 const char* plugin_transform(const char* input) {
     if (input == NULL) {
         return NULL;
     }
 
-    printf("[logger] %s\n", input);
-    fflush(stdout); 
-    return strdup(input);
+    log_line(input, strlen(input));
+    //pass-through: hand the same buffer on, no copy
+    return input;
+}
+
+__attribute__((visibility("default")))
+message_t* plugin_transform_v2(message_t* input) {
+    //write by length so NUL bytes in the payload are printed too
+    log_line(input->data, input->len);
+    return input;
+}
+
+__attribute__((visibility("default")))
+void plugin_control(message_kind_t kind){
+    if((kind == MESSAGE_FLUSH || kind == MESSAGE_END) && sink_ready){
+        output_sink_flush(&sink);
+    }
+}
+
+__attribute__((visibility("default")))
+void plugin_idle(void){
+    if(sink_ready){
+        output_sink_flush(&sink);
+    }
 }
+
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
     return common_plugin_init(plugin_transform, "logger", queue_size);
-}
\ No newline at end of file
+}
+
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void){
+    //prints in arrival order, so it is not stateless, but it never waits
+    return PLUGIN_CAP_NONBLOCKING;
+}
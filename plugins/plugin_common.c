@@ -1,116 +1,884 @@
+#define _GNU_SOURCE
 #include "plugin_common.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <unistd.h>
 
 #define RED   "\033[0;31m"
 #define GREEN "\033[0;32m"
 #define YELLOW "\033[1;33m"
 #define NC    "\033[0m"
+#define BLUE  "\033[0;34m"
+//maximum number of items the consumer thread takes from its queue at once
+#define PLUGIN_BATCH_SIZE 64
+//polls a blocked put/get makes before parking when there is more than one core
+#define PLUGIN_QUEUE_SPIN 200
+//items a pool worker takes at once; small so the other workers get a share
+#define PLUGIN_POOL_BATCH 4
+//items a stage task handles before letting other stages have its pool thread
+#define PLUGIN_TASK_BUDGET 64
+//reorder slot states
+#define PLUGIN_SLOT_EMPTY 0
+#define PLUGIN_SLOT_READY 1
+#define PLUGIN_SLOT_DROPPED 2
+#define PLUGIN_SLOT_END 3
+//task_state of a stage run as a task
+#define PLUGIN_TASK_IDLE 0 //queue drained, nothing scheduled
+#define PLUGIN_TASK_RUNNING 1 //scheduled or running
+#define PLUGIN_TASK_PARKED 2 //next stage full: waits for its consumer to take an item
+#define PLUGIN_TASK_WOKEN 3 //running, and the next stage took an item meanwhile
+//what a legacy string stage sends downstream for an END control message
+#define PLUGIN_END_TEXT "<END>"
 //global variables
+//the legacy single-instance ABI (plugin_init & co.) works on this context; the
+//instance ABI (plugin_instance_*) allocates one context per stage instead
 static plugin_context_t context;
-//this plugin assumes only one instance of this plugin is loaded
+//host services shared by every instance of this plugin, used by plugin_alloc
+static const plugin_host_t* module_host;
+//context being set up by plugin_instance_create while it runs plugin_init
+static __thread plugin_context_t* creating_context;
+int plugin_log_level = PLUGIN_LOG_WARN;
+//defined only by plugins with a length-preserving transform
+extern void plugin_transform_inplace(char* buf, size_t len) __attribute__((weak));
+//defined only by plugins written against the message ABI
+extern message_t* plugin_transform_v2(message_t* input) __attribute__((weak));
+//defined only by plugins that react to FLUSH/STATS/END control messages
+extern void plugin_control(message_kind_t kind) __attribute__((weak));
+//defined only by plugins that hold on to output until they run out of input
+extern void plugin_idle(void) __attribute__((weak));
 
-const char* common_plugin_init(const char* (*process_function)(const char*),const char* name, int queue_size){
-    context.name = name;
-    context.process_function = process_function;
-    context.queue = malloc(sizeof(consumer_producer_t));
-    if (context.queue == NULL) {
+//attributes for a new stage thread: pinned where the host's placement says
+static void thread_attr_init(plugin_context_t* ctx, pthread_attr_t* attr){
+    pthread_attr_init(attr);
+    int cpu = ctx->host != NULL && ctx->host->thread_cpu != NULL ? ctx->host->thread_cpu() : -1;
+    if(cpu >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+}
+
+static void pool_free(plugin_pool_t* pool){
+    pthread_mutex_destroy(&pool->take_lock);
+    pthread_mutex_destroy(&pool->emit_lock);
+    pthread_cond_destroy(&pool->window_cond);
+    free(pool->slots);
+    free(pool->threads);
+    free(pool);
+}
+
+//start ctx->workers pool threads on the stage queue
+static const char* pool_start(plugin_context_t* ctx){
+    plugin_pool_t* pool = calloc(1, sizeof(plugin_pool_t));
+    if(pool == NULL){
+        return "Memory allocation failed";
+    }
+    //room for every worker's batch twice over, so workers can run ahead of
+    //one slow item before they have to wait for it
+    pool->window = (size_t)ctx->workers * PLUGIN_POOL_BATCH * 2;
+    pool->slots = calloc(pool->window, sizeof(plugin_pool_slot_t));
+    pool->threads = calloc(ctx->workers, sizeof(pthread_t));
+    if(pool->slots == NULL || pool->threads == NULL){
+        free(pool->slots);
+        free(pool->threads);
+        free(pool);
+        return "Memory allocation failed";
+    }
+    pthread_mutex_init(&pool->take_lock, NULL);
+    pthread_mutex_init(&pool->emit_lock, NULL);
+    pthread_cond_init(&pool->window_cond, NULL);
+    ctx->pool = pool;
+    for(int i = 0; i < ctx->workers; i++){
+        pthread_attr_t attr;
+        thread_attr_init(ctx, &attr);
+        int rc = pthread_create(&pool->threads[i], &attr, plugin_pool_worker_thread, ctx);
+        pthread_attr_destroy(&attr);
+        if(rc != 0){
+            //stop the workers already running, then give up
+            consumer_producer_signal_finished(ctx->queue);
+            for(int j = 0; j < i; j++){
+                pthread_join(pool->threads[j], NULL);
+            }
+            ctx->pool = NULL;
+            pool_free(pool);
+            return "Failed to create consumer thread";
+        }
+        pool->count++;
+    }
+    return NULL;
+}
+
+//take the runtime log level from ANALYZER_LOG_LEVEL (a name or a number)
+static void log_level_init(void){
+    static const char* names[] = { "error", "warn", "info", "debug" };
+    static int done;
+    if(done){
+        return;
+    }
+    done = 1;
+    const char* value = getenv("ANALYZER_LOG_LEVEL");
+    if(value == NULL){
+        return;
+    }
+    for(int i = 0; i <= PLUGIN_LOG_DEBUG; i++){
+        if(strcasecmp(value, names[i]) == 0 || (value[0] == '0' + i && value[1] == '\0')){
+            plugin_log_level = i;
+            return;
+        }
+    }
+    fprintf(stderr, "[WARN] Unknown ANALYZER_LOG_LEVEL '%s', using warn\n", value);
+}
+
+//--metrics: the host reads our input queue through the stats block
+static void sample_queue(void* queue, stage_queue_sample_t* out){
+    consumer_producer_t* q = queue;
+    out->depth = consumer_producer_count(q);
+    out->capacity = q->capacity;
+    out->bytes = consumer_producer_bytes(q);
+    out->waiting_consumers = atomic_load(&q->empty_waiters);
+    out->waiting_producers = atomic_load(&q->full_waiters);
+}
+
+static const char* context_init(plugin_context_t* ctx, const char* (*process_function)(const char*), const char* name, int queue_size){
+    log_level_init();
+    ctx->name = name;
+    ctx->trace_id = ctx->host != NULL && ctx->host->trace_source != NULL ? ctx->host->trace_source(name) : -1;
+    ctx->process_function = process_function;
+    ctx->process_inplace = plugin_transform_inplace;
+    ctx->process_message = plugin_transform_v2;
+    ctx->process_control = plugin_control;
+    ctx->process_idle = plugin_idle;
+    ctx->queue = malloc(sizeof(consumer_producer_t));
+    if (ctx->queue == NULL) {
         fprintf(stderr, "[ERROR] Failed to allocate item buffer\n");
         return "Memory allocation failed";
     }
-    //add check here that if this failed reutnr error message 
-    const char* err = consumer_producer_init(context.queue, queue_size);
+    //every hop has one producer (main or the previous plugin's consumer thread)
+    //and one consumer (our consumer thread), so the lock-free SPSC ring applies
+    const char* err = consumer_producer_init_backend(ctx->queue, queue_size, CP_BACKEND_SPSC);
     if (err != NULL) {
-        free(context.queue);
+        free(ctx->queue);
         return err;
     }
-    if(pthread_create(&context.consumer_thread, NULL, plugin_consumer_thread, &context) != 0){
-        consumer_producer_destroy(context.queue);
-        free(context.queue);
-        return "Failed to create consumer thread";
+    //queued items are messages, made from host buffers when a host is attached
+    consumer_producer_set_messages(ctx->queue);
+    if(ctx->host != NULL){
+        consumer_producer_set_allocator(ctx->queue, ctx->host->alloc, ctx->host->free);
     }
-    //add check here that if this failed return error message and destroy 
-    context.initialized=1;
-    context.finished= 0;
-    log_info(&context, "Plugin initialized successfully");
+    //--stats: the queue stamps items so we can tell how long they waited
+    ctx->stats = ctx->host != NULL && ctx->host->stats != NULL ? ctx->host->stats(name) : NULL;
+    if(ctx->stats != NULL){
+        consumer_producer_set_stamping(ctx->queue);
+    }
+    //spinning only pays off when the neighbouring stage runs on another core
+    if(sysconf(_SC_NPROCESSORS_ONLN) > 1){
+        consumer_producer_set_spin(ctx->queue, PLUGIN_QUEUE_SPIN);
+    }
+    ctx->initialized = 1;
+    ctx->finished = 0;
+    if(ctx->host != NULL && ctx->host->schedule != NULL && ctx->workers == 1){
+        //no thread of our own: producers schedule us on the host's pool
+        //whenever our queue gets an item, and nothing here ever waits
+        ctx->task = 1;
+        atomic_init(&ctx->task_state, PLUGIN_TASK_IDLE);
+        pthread_mutex_init(&ctx->mutex, NULL);
+        pthread_cond_init(&ctx->done, NULL);
+        consumer_producer_set_spin(ctx->queue, 0);
+    }else if(ctx->workers > 1){
+        err = pool_start(ctx);
+        if(err != NULL){
+            ctx->initialized = 0;
+            consumer_producer_destroy(ctx->queue);
+            free(ctx->queue);
+            return err;
+        }
+    }else{
+        pthread_attr_t attr;
+        thread_attr_init(ctx, &attr);
+        int rc = pthread_create(&ctx->consumer_thread, &attr, plugin_consumer_thread, ctx);
+        pthread_attr_destroy(&attr);
+        if(rc != 0){
+            ctx->initialized = 0;
+            consumer_producer_destroy(ctx->queue);
+            free(ctx->queue);
+            return "Failed to create consumer thread";
+        }
+    }
+    if(ctx->stats != NULL){
+        ctx->stats->sample_queue = sample_queue;
+        atomic_store_explicit(&ctx->stats->queue, ctx->queue, memory_order_release);
+    }
+    log_info(ctx, "Plugin initialized successfully");
+    PLUGIN_TRACE(ctx, PLUGIN_TRACE_INIT, 0, 0);
     return NULL;
-    //1. initialize process_function
-    //2. initialize queue with queue size 
-    //3. set the initialized flag 
+}
+
+const char* common_plugin_init(const char* (*process_function)(const char*),const char* name, int queue_size){
+    //plugin_init is also how plugin_instance_create learns the transform and
+    //name, so route the call to the context being created when there is one
+    if(creating_context != NULL){
+        return context_init(creating_context, process_function, name, queue_size);
+    }
+    return context_init(&context, process_function, name, queue_size);
+}
+
+static int has_next(const plugin_context_t* ctx) {
+    return ctx->next_place_work != NULL || ctx->next_instance != NULL;
+}
+
+//--stats: a one-thread stage forwards right after its transform, so the
+//clock read that ended the transform also starts the forward
+static uint64_t stats_forward_start(plugin_context_t* ctx) {
+    uint64_t mark = ctx->stats_mark;
+    ctx->stats_mark = 0;
+    return mark != 0 ? mark : stage_stats_now();
+}
+
+//hand a message we own to the next stage. an instance takes the message
+//itself; a plain place_work takes a string, which under the host contract it
+//then owns, while in legacy mode it copies it and we free ours. a string
+//can only say END, as the old sentinel text; other control messages stop here
+static void forward_item(plugin_context_t* ctx, message_t* msg) {
+    const char* err;
+    int data = msg->kind == MESSAGE_DATA;
+    uint64_t start = ctx->stats != NULL && data ? stats_forward_start(ctx) : 0;
+    if (ctx->next_instance != NULL) {
+        err = ctx->next_place_message(ctx->next_instance, msg);
+    } else if (msg->kind != MESSAGE_DATA) {
+        err = NULL;
+        if (msg->kind == MESSAGE_END) {
+            char* str = ctx->host != NULL ? plugin_alloc(sizeof(PLUGIN_END_TEXT)) : PLUGIN_END_TEXT;
+            if (str != NULL && ctx->host != NULL) {
+                memcpy(str, PLUGIN_END_TEXT, sizeof(PLUGIN_END_TEXT));
+            }
+            err = str != NULL ? ctx->next_place_work(str) : "Memory allocation failed";
+        }
+        plugin_message_free(msg);
+    } else if (ctx->host != NULL) {
+        char* str = message_detach(msg, plugin_alloc, plugin_free);
+        err = str != NULL ? ctx->next_place_work(str) : "Memory allocation failed";
+    } else {
+        err = ctx->next_place_work(msg->data);
+        plugin_message_free(msg);
+    }
+    if (err != NULL) {
+        log_error(ctx, err);
+    }
+    if (start != 0) {
+        histogram_record(&ctx->stats->forward, stage_stats_now() - start);
+    }
+    if (data) {
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_FORWARDED, 0, 0);
+    }
+}
+
+//--stats: what a stage thread (or one run of a task) cost in CPU. a thread
+//charges its stage once, as it ends
+static void stats_cpu_begin(plugin_context_t* ctx, stage_cpu_t* start) {
+    if (ctx->stats != NULL) {
+        stage_cpu_read(start);
+    }
+}
+
+static void stats_cpu_end(plugin_context_t* ctx, const stage_cpu_t* start) {
+    if (ctx->stats != NULL) {
+        stage_cpu_t end;
+        stage_cpu_read(&end);
+        stage_stats_cpu_add(ctx->stats, start, &end);
+    }
+}
+
+//the transform borrows msg and either returns it (pass-through) or a new
+//message. the message is ours here, so a length-preserving transform can
+//work on it in place instead; a string-only transform goes through a shim
+static message_t* apply_transform(const plugin_stage_fn_t* fn, message_t* msg) {
+    if (fn->transform_inplace != NULL) {
+        fn->transform_inplace(msg->data, msg->len);
+        return msg;
+    }
+    if (fn->transform_v2 != NULL) {
+        return fn->transform_v2(msg);
+    }
+    char* result = (char*)fn->transform(msg->data);
+    if (result == msg->data || result == NULL) {
+        return result == NULL ? NULL : msg;
+    }
+    message_t* wrapped = message_wrap(plugin_alloc, result, strlen(result));
+    if (wrapped == NULL) {
+        plugin_free(result);
+    }
+    return wrapped;
+}
+
+//hand a control message to the plugin (if it wants them) in stream order;
+//END is handled by the framework itself
+static void run_control(plugin_context_t* ctx, const message_t* msg) {
+    if (ctx->process_control != NULL) {
+        ctx->process_control(msg->kind);
+    }
+}
+
+//run this stage's transform and every fused one after it; NULL means the
+//item was dropped
+static message_t* run_transform(plugin_context_t* ctx, message_t* item) {
+    uint64_t start = 0;
+    if (ctx->stats != NULL) {
+        start = stage_stats_now();
+        stage_stats_item_in(ctx->stats, item->len, item->queued_at, start);
+    }
+    //USDT: transform_start(stage name, item, length), transform_end(stage
+    //name, result or 0 when dropped), on the thread running the stage
+    ANALYZER_PROBE3(transform_start, ctx->name, item, item->len);
+    plugin_stage_fn_t own = { ctx->process_function, ctx->process_inplace, ctx->process_message };
+    message_t* transformed = apply_transform(&own, item);
+    //fused stages run right here, each borrowing the previous result
+    for (int i = 0; i < ctx->fused_count && transformed != NULL; i++) {
+        if (transformed != item) {
+            plugin_message_free(item);
+        }
+        item = transformed;
+        transformed = apply_transform(&ctx->fused[i], item);
+    }
+    if (transformed != item) {
+        plugin_message_free(item);
+    }
+    ANALYZER_PROBE2(transform_end, ctx->name, transformed);
+    if (transformed == NULL) {
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_DROP, 0, 0);
+        log_error(ctx, "transform failed, dropping item");
+    }
+    if (start != 0) {
+        uint64_t end = stage_stats_now();
+        histogram_record(&ctx->stats->transform, end - start);
+        //pool workers share ctx and forward later, in order
+        if (ctx->pool == NULL) {
+            ctx->stats_mark = end;
+        }
+        if (transformed != NULL) {
+            stage_stats_item_out(ctx->stats, transformed->len);
+        }
+    }
+    return transformed;
+}
+
+//run one dequeued item through this stage. returns what goes on to the next
+//stage, or NULL when nothing does (dropped, or freed by the last stage)
+static message_t* stage_process(plugin_context_t* ctx, message_t* item) {
+    int data = item->kind == MESSAGE_DATA;
+    if (!data) {
+        LOG_DEBUG(ctx, "got control message %d", (int)item->kind);
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_CONTROL, item->kind, 0);
+        //control messages skip the transform and keep their place in the stream
+        run_control(ctx, item);
+    } else {
+        LOG_DEBUG(ctx, "got item: %.*s", (int)item->len, item->data);
+        //the address ties this to the previous stage's forward (trace_decode -c)
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_ITEM, item->len, (uintptr_t)item);
+        item = run_transform(ctx, item);
+        if (item == NULL) {
+            return NULL;
+        }
+        LOG_DEBUG(ctx, "transformed result: %.*s", (int)item->len, item->data);
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_RESULT, item->len, 0);
+    }
+    if (!has_next(ctx)) {
+        if (data) {
+            LOG_DEBUG(ctx, "no next plugin — freeing output");
+            PLUGIN_TRACE(ctx, PLUGIN_TRACE_LAST_STAGE, 0, 0);
+        }
+        plugin_message_free(item);
+        return NULL;
+    }
+    if (data) {
+        LOG_DEBUG(ctx, "forwarding");
+        PLUGIN_TRACE(ctx, PLUGIN_TRACE_FORWARD, 0, (uintptr_t)item);
+    }
+    return item;
 }
 
 void* plugin_consumer_thread(void* arg) {
     plugin_context_t* ctx = (plugin_context_t*)arg;
+    message_t* batch[PLUGIN_BATCH_SIZE];
+    int done = 0;
+    stage_cpu_t cpu;
+    stats_cpu_begin(ctx, &cpu);
 
-    while (1) {
-        char* result = consumer_producer_get(ctx->queue);
-        if (result == NULL) {
+    while (!done) {
+        //take everything that is ready with one queue round trip
+        int count = consumer_producer_get_messages(ctx->queue, batch, PLUGIN_BATCH_SIZE);
+        if (count == 0) {
             break;
         }
 
-        char msg[256];
-        snprintf(msg, sizeof(msg), "got item: %s", result);
-        log_info(ctx, msg);
+        for (int i = 0; i < count; i++) {
+            if (done) {
+                //items queued after END are never processed
+                plugin_message_free(batch[i]);
+                continue;
+            }
+            int end = batch[i]->kind == MESSAGE_END;
+            message_t* out = stage_process(ctx, batch[i]);
+            if (out != NULL) {
+                forward_item(ctx, out);
+            }
+            if (end) {
+                //END went down the chain; this stage is done
+                consumer_producer_signal_finished(ctx->queue);
+                done = 1;
+            }
+        }
+        //caught up with the input: a plugin holding output lets it go now
+        if (!done && ctx->process_idle != NULL && consumer_producer_count(ctx->queue) == 0) {
+            ctx->process_idle();
+        }
+    }
+
+    stats_cpu_end(ctx, &cpu);
+    log_info(ctx, "plugin thread finished");
+    PLUGIN_TRACE(ctx, PLUGIN_TRACE_FINISHED, 0, 0);
+    ctx->finished = 1;
+    return NULL;
+}
+
+static void stage_task(void* arg);
+
+//an item was just queued for a task stage: schedule it unless it already
+//is. the fence pairs with the one in stage_task going idle: either we see
+//it idle, or it sees our item
+static void task_wake(plugin_context_t* ctx) {
+    atomic_thread_fence(memory_order_seq_cst);
+    int idle = PLUGIN_TASK_IDLE;
+    if (atomic_load_explicit(&ctx->task_state, memory_order_relaxed) == PLUGIN_TASK_IDLE
+        && atomic_compare_exchange_strong(&ctx->task_state, &idle, PLUGIN_TASK_RUNNING)) {
+        ctx->host->schedule(stage_task, ctx, 0);
+    }
+}
 
-        if (strcmp(result, "<END>") == 0) {
-            if (ctx->next_place_work != NULL) {
-                ctx->next_place_work(strdup("<END>"));
+//the next stage took an item from its queue (called on the thread that took
+//it): reschedule the task if it is parked on that queue, or tell it to try
+//again if it is still on its way to parking
+static void task_unpark(void* arg) {
+    plugin_context_t* ctx = arg;
+    int state = atomic_load(&ctx->task_state);
+    while (state == PLUGIN_TASK_PARKED || state == PLUGIN_TASK_RUNNING) {
+        int next = state == PLUGIN_TASK_PARKED ? PLUGIN_TASK_RUNNING : PLUGIN_TASK_WOKEN;
+        if (atomic_compare_exchange_weak(&ctx->task_state, &state, next)) {
+            if (next == PLUGIN_TASK_RUNNING) {
+                ctx->host->schedule(stage_task, ctx, 0);
             }
-            free(result);
-            consumer_producer_signal_finished(ctx->queue);
-            break;
+            return;
         }
+    }
+}
+
+//END has passed: wake plugin_instance_wait_finished. the task must not touch
+//ctx afterwards, the host may destroy it right away
+static void task_finish(plugin_context_t* ctx) {
+    consumer_producer_signal_finished(ctx->queue);
+    log_info(ctx, "plugin task finished");
+    PLUGIN_TRACE(ctx, PLUGIN_TRACE_FINISHED, 0, 0);
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->finished = 1;
+    pthread_cond_broadcast(&ctx->done);
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+//hand an item on without blocking the pool thread; 0 means the next stage is
+//full and msg is still ours. without a try export (or a next stage) we fall
+//back to the plain forward
+static int task_forward(plugin_context_t* ctx, message_t* msg) {
+    if (ctx->next_try_place != NULL) {
+        return ctx->next_try_place(ctx->next_instance, msg);
+    }
+    forward_item(ctx, msg);
+    return 1;
+}
+
+//hand the stalled item on, or give the pool thread back until the next
+//stage's consumer takes an item (task_unpark reschedules us). 1 means the item
+//went through; 0 means the caller must return at once, as the task may
+//already be running again on another thread
+static int task_forward_or_park(plugin_context_t* ctx) {
+    while (!task_forward(ctx, ctx->stalled)) {
+        if (ctx->next_park == NULL) {
+            //no way to be woken: queue behind the next stage so it drains first
+            sched_yield();
+            ctx->host->schedule(stage_task, ctx, 1);
+            return 0;
+        }
+        //park first, then try once more: a get that ran after our failed
+        //put but before we parked would otherwise never wake us
+        ctx->next_park(ctx->next_instance, task_unpark, ctx);
+        if (task_forward(ctx, ctx->stalled)) {
+            return 1;
+        }
+        int running = PLUGIN_TASK_RUNNING;
+        if (atomic_compare_exchange_strong(&ctx->task_state, &running, PLUGIN_TASK_PARKED)) {
+            //the consumer that will wake us may be waiting for a CPU
+            sched_yield();
+            return 0;
+        }
+        //PLUGIN_TASK_WOKEN: an item was taken since we parked, go again
+        atomic_store(&ctx->task_state, PLUGIN_TASK_RUNNING);
+    }
+    return 1;
+}
+
+//a stage run as a task: work through the queue up to a budget, then give the
+//pool thread back. when the next stage is full the task parks on its queue
+//instead of waiting, so any number of stages share a few threads
+static void stage_task_run(plugin_context_t* ctx) {
+    for (int n = 0; n < PLUGIN_TASK_BUDGET; n++) {
+        if (ctx->stalled == NULL) {
+            message_t* item;
+            if (consumer_producer_try_get_messages(ctx->queue, &item, 1) == 0) {
+                //still ours alone: once the task is idle another thread may
+                //run the stage
+                if (ctx->process_idle != NULL) {
+                    ctx->process_idle();
+                }
+                //idle until a producer schedules us again; re-check for an
+                //item queued while we were deciding
+                atomic_store(&ctx->task_state, PLUGIN_TASK_IDLE);
+                atomic_thread_fence(memory_order_seq_cst);
+                int idle = PLUGIN_TASK_IDLE;
+                if (consumer_producer_count(ctx->queue) == 0
+                    || !atomic_compare_exchange_strong(&ctx->task_state, &idle, PLUGIN_TASK_RUNNING)) {
+                    return;
+                }
+                continue;
+            }
+            ctx->stalled_end = item->kind == MESSAGE_END;
+            ctx->stalled = stage_process(ctx, item);
+            ctx->stalled_at = ctx->stats != NULL && ctx->next_try_place != NULL && ctx->stalled != NULL && ctx->stalled->kind == MESSAGE_DATA ? stats_forward_start(ctx) : 0;
+        }
+        if (ctx->stalled != NULL) {
+            //forward_item traces its own end; a try place is traced here
+            int traced = ctx->next_try_place != NULL && ctx->stalled->kind == MESSAGE_DATA;
+            if (!task_forward_or_park(ctx)) {
+                return;
+            }
+            if (ctx->stalled_at != 0) {
+                histogram_record(&ctx->stats->forward, stage_stats_now() - ctx->stalled_at);
+            }
+            if (traced) {
+                PLUGIN_TRACE(ctx, PLUGIN_TRACE_FORWARDED, 0, 0);
+            }
+            ctx->stalled = NULL;
+        }
+        if (ctx->stalled_end) {
+            task_finish(ctx);
+            return;
+        }
+    }
+    ctx->host->schedule(stage_task, ctx, 1);
+}
+
+//pool threads run every task stage, so each run is charged on its own
+static void stage_task(void* arg) {
+    plugin_context_t* ctx = arg;
+    stage_cpu_t cpu;
+    stats_cpu_begin(ctx, &cpu);
+    stage_task_run(ctx);
+    stats_cpu_end(ctx, &cpu);
+}
+
+//forward every item at the head of the reorder window that is ready, in
+//sequence order; caller holds emit_lock, so the next stage sees one producer
+static void pool_emit(plugin_context_t* ctx) {
+    plugin_pool_t* pool = ctx->pool;
+    plugin_pool_slot_t* slot = &pool->slots[pool->next_emit % pool->window];
+    while (slot->state != PLUGIN_SLOT_EMPTY) {
+        if (slot->state != PLUGIN_SLOT_DROPPED) {
+            if (slot->item->kind != MESSAGE_DATA) {
+                //emitting is serialized, so the plugin sees controls in order
+                run_control(ctx, slot->item);
+            }
+            if (has_next(ctx)) {
+                if (slot->item->kind == MESSAGE_DATA) {
+                    PLUGIN_TRACE(ctx, PLUGIN_TRACE_FORWARD, 0, (uintptr_t)slot->item);
+                }
+                forward_item(ctx, slot->item);
+            } else {
+                plugin_message_free(slot->item);
+            }
+        }
+        slot->item = NULL;
+        slot->state = PLUGIN_SLOT_EMPTY;
+        pool->next_emit++;
+        slot = &pool->slots[pool->next_emit % pool->window];
+    }
+    pthread_cond_broadcast(&pool->window_cond);
+}
+
+void* plugin_pool_worker_thread(void* arg) {
+    plugin_context_t* ctx = (plugin_context_t*)arg;
+    plugin_pool_t* pool = ctx->pool;
+    message_t* batch[PLUGIN_POOL_BATCH];
+    int states[PLUGIN_POOL_BATCH];
+    stage_cpu_t cpu;
+    stats_cpu_begin(ctx, &cpu);
 
-        const char* transformedText = ctx->process_function(result);
-        snprintf(msg, sizeof(msg), "transformed result: %s", transformedText);
-        log_info(ctx, msg);
+    while (1) {
+        //dequeue and number a batch; the take lock makes us the queue's only
+        //consumer for the moment, which also keeps the SPSC ring valid
+        pthread_mutex_lock(&pool->take_lock);
+        pthread_mutex_lock(&pool->emit_lock);
+        while (pool->next_take + PLUGIN_POOL_BATCH - pool->next_emit > pool->window) {
+            pthread_cond_wait(&pool->window_cond, &pool->emit_lock);
+        }
+        pthread_mutex_unlock(&pool->emit_lock);
+        int count = pool->ended ? 0 : consumer_producer_get_messages(ctx->queue, batch, PLUGIN_POOL_BATCH);
+        size_t seq = pool->next_take;
+        pool->next_take += count;
+        for (int i = 0; i < count; i++) {
+            if (pool->ended) {
+                //items queued after <END> are never processed
+                states[i] = PLUGIN_SLOT_DROPPED;
+            } else if (batch[i]->kind == MESSAGE_END) {
+                states[i] = PLUGIN_SLOT_END;
+                pool->ended = 1;
+                //wake the workers still waiting for items
+                consumer_producer_signal_finished(ctx->queue);
+            } else {
+                states[i] = PLUGIN_SLOT_READY;
+            }
+        }
+        pthread_mutex_unlock(&pool->take_lock);
+        if (count == 0) {
+            break;
+        }
 
-        if (ctx->next_place_work != NULL) {
-            snprintf(msg, sizeof(msg), "forwarding: %s", transformedText);
-            log_info(ctx, msg);
-            ctx->next_place_work(strdup(transformedText));
-        } else {
-            log_info(ctx, "no next plugin — freeing output");
-            if (strcmp(transformedText, "<END>") != 0) {
-                free((void*)transformedText);
+        for (int i = 0; i < count; i++) {
+            if (states[i] == PLUGIN_SLOT_DROPPED) {
+                plugin_message_free(batch[i]);
+                batch[i] = NULL;
+            } else if (states[i] == PLUGIN_SLOT_READY && batch[i]->kind == MESSAGE_DATA) {
+                PLUGIN_TRACE(ctx, PLUGIN_TRACE_ITEM, batch[i]->len, (uintptr_t)batch[i]);
+                batch[i] = run_transform(ctx, batch[i]);
+                if (batch[i] == NULL) {
+                    states[i] = PLUGIN_SLOT_DROPPED;
+                } else {
+                    PLUGIN_TRACE(ctx, PLUGIN_TRACE_RESULT, batch[i]->len, 0);
+                }
             }
         }
 
-        free(result);
+        pthread_mutex_lock(&pool->emit_lock);
+        for (int i = 0; i < count; i++) {
+            plugin_pool_slot_t* slot = &pool->slots[(seq + i) % pool->window];
+            slot->item = batch[i];
+            slot->state = states[i];
+        }
+        pool_emit(ctx);
+        pthread_mutex_unlock(&pool->emit_lock);
     }
 
+    stats_cpu_end(ctx, &cpu);
     log_info(ctx, "plugin thread finished");
+    PLUGIN_TRACE(ctx, PLUGIN_TRACE_FINISHED, 0, 0);
     ctx->finished = 1;
     return NULL;
 }
 
+void* plugin_alloc(size_t size) {
+    if (module_host != NULL) {
+        return module_host->alloc(size);
+    }
+    return malloc(size);
+}
+
+void plugin_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (module_host != NULL) {
+        module_host->free(ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+message_t* plugin_message_alloc(size_t cap) {
+    return message_new(plugin_alloc, cap);
+}
+
+void plugin_message_free(message_t* msg) {
+    message_free(msg, plugin_free);
+}
+
+void plugin_log(const plugin_context_t* context, int level, const char* format, ...) {
+    static const char* labels[] = { RED "[ERROR]", YELLOW "[WARN]", GREEN "[INFO]", BLUE "[DEBUG]" };
+    //stdout carries the pipeline's output, so logs go to stderr; formatting
+    //straight into the stream keeps long items whole, the lock keeps lines
+    //from different stages apart
+    va_list args;
+    va_start(args, format);
+    flockfile(stderr);
+    fprintf(stderr, "%s[%s] - ", labels[level], context->name);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "%s\n", NC);
+    funlockfile(stderr);
+    va_end(args);
+}
 
 void log_error(plugin_context_t* context, const char* message) {
-    fprintf(stderr, "%s[ERROR][%s] - %s%s\n", RED, context->name, message, NC);
-    fflush(stdout);
+    LOG_ERROR(context, "%s", message);
 }
 
 void log_info(plugin_context_t* context, const char* message) {
-    //printf("%s[INFO][%s] - %s%s\n", GREEN, context->name, message, NC);
-    //fflush(stdout);
+    LOG_INFO(context, "%s", message);
 }
 
 const char* plugin_get_name(void){
     return context.name; 
 }
 
-__attribute__((visibility("default")))
-const char* plugin_place_work(const char* str){
+static const char* context_place_work(plugin_context_t* ctx, const char* str){
     if (str == NULL) {
         return "NULL input not allowed";
     }
-    if(context.initialized!=1){
+    if(ctx->initialized!=1){
+        if(ctx->host != NULL){
+            ctx->host->free((void*)str);
+        }
+        return "Plugin not initialized";
+    }
+    //measure the string once; from here on the length travels with it
+    size_t len = strlen(str);
+    message_t* msg;
+    if(len == sizeof(PLUGIN_END_TEXT) - 1 && memcmp(str, PLUGIN_END_TEXT, len) == 0){
+        //a string caller's END sentinel becomes a control message right at
+        //the door; past this point nothing compares payloads
+        if(ctx->host != NULL){
+            plugin_free((void*)str);
+        }
+        msg = message_control(plugin_alloc, MESSAGE_END);
+    }else if(ctx->host != NULL){
+        //under the host contract the buffer is ours now: wrap it, no copy
+        msg = message_wrap(plugin_alloc, (char*)str, len);
+        if(msg == NULL){
+            plugin_free((void*)str);
+        }
+    }else{
+        msg = plugin_message_alloc(len);
+        if(msg != NULL){
+            memcpy(msg->data, str, len + 1);
+            msg->len = len;
+        }
+    }
+    if(msg == NULL){
+        return "Memory allocation failed for item";
+    }
+    const char* err = consumer_producer_put_message(ctx->queue, msg);
+    if(ctx->task){
+        task_wake(ctx);
+    }
+    return err;
+}
+
+static const char* context_place_message(plugin_context_t* ctx, message_t* msg){
+    if (msg == NULL) {
+        return "NULL input not allowed";
+    }
+    if(ctx->initialized!=1){
+        plugin_message_free(msg);
         return "Plugin not initialized";
     }
-    return consumer_producer_put(context.queue, str);
+    const char* err = consumer_producer_put_message(ctx->queue, msg);
+    if(ctx->task){
+        task_wake(ctx);
+    }
+    return err;
+}
+
+static const char* context_set_queue_byte_budget(plugin_context_t* ctx, size_t max_bytes){
+    if(ctx->initialized!=1){
+        return "Plugin not initialized";
+    }
+    consumer_producer_set_byte_budget(ctx->queue, max_bytes);
+    return NULL;
+}
+
+static const char* context_wait_finished(plugin_context_t* ctx){
+    if(ctx->initialized!=1){
+        return "Plugin not initialized";
+    }
+    if(ctx->task){
+        pthread_mutex_lock(&ctx->mutex);
+        while(!ctx->finished){
+            pthread_cond_wait(&ctx->done, &ctx->mutex);
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        return NULL;
+    }
+    if(ctx->pool != NULL){
+        for(int i = 0; i < ctx->pool->count; i++){
+            pthread_join(ctx->pool->threads[i], NULL);
+        }
+        return NULL;
+    }
+    pthread_join(ctx->consumer_thread, NULL);
+    return NULL;
+}
+
+static const char* context_fini(plugin_context_t* ctx){
+    if (ctx->initialized != 1) {
+        return "Plugin not initialized";
+    }
+    // Signal that no more items will be added
+    consumer_producer_signal_finished(ctx->queue);
+    if(ctx->stats != NULL){
+        atomic_store(&ctx->stats->queue, NULL);
+    }
+    // Clean up the queue and free memory
+    consumer_producer_destroy(ctx->queue);
+    free(ctx->queue);
+    if(ctx->pool != NULL){
+        pool_free(ctx->pool);
+        ctx->pool = NULL;
+    }
+    if(ctx->task){
+        plugin_message_free(ctx->stalled);
+        ctx->stalled = NULL;
+        pthread_cond_destroy(&ctx->done);
+        pthread_mutex_destroy(&ctx->mutex);
+    }
+    // Mark as uninitialized
+    ctx->initialized = 0;
+    ctx->finished = 1;
+    return NULL;
+}
+
+__attribute__((visibility("default")))
+const char* plugin_place_work(const char* str){
+    return context_place_work(&context, str);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_init_with_host(const plugin_host_t* host, int queue_size){
+    if(host == NULL || host->alloc == NULL || host->free == NULL){
+        return "Invalid host";
+    }
+    context.host = host;
+    module_host = host;
+    const char* err = plugin_init(queue_size);
+    if(err != NULL){
+        context.host = NULL;
+    }
+    return err;
+}
+
+__attribute__((visibility("default")))
+const char* plugin_set_queue_byte_budget(size_t max_bytes){
+    return context_set_queue_byte_budget(&context, max_bytes);
 }
 
 __attribute__((visibility("default")))
@@ -120,27 +888,125 @@ void plugin_attach(const char* (*next_place_work)(const char*)){
 
 __attribute__((visibility("default")))
 const char* plugin_wait_finished(void){
-    if(context.initialized!=1){
-        return "Plugin not initialized";
+    return context_wait_finished(&context);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_fini(void) {
+    return context_fini(&context);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_create(const plugin_host_t* host, int queue_size, void** instance){
+    return plugin_instance_create_workers(host, queue_size, 1, instance);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_create_workers(const plugin_host_t* host, int queue_size, int workers, void** instance){
+    if(host == NULL || host->alloc == NULL || host->free == NULL || instance == NULL){
+        return "Invalid host";
+    }
+    if(workers < 1){
+        return "Invalid worker count";
+    }
+    plugin_context_t* ctx = calloc(1, sizeof(plugin_context_t));
+    if(ctx == NULL){
+        return "Memory allocation failed";
+    }
+    ctx->host = host;
+    ctx->workers = workers;
+    module_host = host;
+    creating_context = ctx;
+    const char* err = plugin_init(queue_size);
+    creating_context = NULL;
+    if(err != NULL){
+        free(ctx);
+        return err;
     }
-    pthread_join(context.consumer_thread, NULL);
+    *instance = ctx;
     return NULL;
 }
 
 __attribute__((visibility("default")))
-const char* plugin_fini(void) {
-    if (context.initialized != 1) {
-        return "Plugin not initialized";
+const char* plugin_instance_fuse(void* instance, const char* (*transform)(const char*), void (*transform_inplace)(char*, size_t), message_t* (*transform_v2)(message_t*)){
+    plugin_context_t* ctx = instance;
+    if(transform == NULL){
+        return "Invalid transform";
     }
-    // Signal that no more items will be added
-    consumer_producer_signal_finished(context.queue);
-    // Wait for the consumer thread to finish
-    //pthread_join(context.consumer_thread, NULL);
-    // Clean up the queue and free memory
-    consumer_producer_destroy(context.queue);
-    free(context.queue);
-    // Mark as uninitialized
-    context.initialized = 0;
-    context.finished = 1;
+    if(ctx->fused_count == PLUGIN_MAX_FUSED){
+        return "Too many fused stages";
+    }
+    ctx->fused[ctx->fused_count].transform = transform;
+    ctx->fused[ctx->fused_count].transform_inplace = transform_inplace;
+    ctx->fused[ctx->fused_count].transform_v2 = transform_v2;
+    ctx->fused_count++;
     return NULL;
-}
\ No newline at end of file
+}
+
+__attribute__((visibility("default")))
+const char* plugin_set_host(const plugin_host_t* host){
+    if(host == NULL || host->alloc == NULL || host->free == NULL){
+        return "Invalid host";
+    }
+    module_host = host;
+    return NULL;
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_place_work(void* instance, const char* str){
+    return context_place_work(instance, str);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_place_message(void* instance, message_t* msg){
+    return context_place_message(instance, msg);
+}
+
+__attribute__((visibility("default")))
+int plugin_instance_try_place_message(void* instance, message_t* msg){
+    plugin_context_t* ctx = instance;
+    if(!consumer_producer_try_put_message(ctx->queue, msg)){
+        return 0;
+    }
+    if(ctx->task){
+        task_wake(ctx);
+    }
+    return 1;
+}
+
+__attribute__((visibility("default")))
+void plugin_instance_park_producer(void* instance, void (*wake)(void*), void* arg){
+    plugin_context_t* ctx = instance;
+    consumer_producer_park(ctx->queue, wake, arg);
+}
+
+__attribute__((visibility("default")))
+void plugin_instance_attach_task(void* instance, int (*next_try_place_message)(void*, message_t*), void (*next_park)(void*, void (*)(void*), void*)){
+    plugin_context_t* ctx = instance;
+    ctx->next_try_place = next_try_place_message;
+    ctx->next_park = next_park;
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_set_queue_byte_budget(void* instance, size_t max_bytes){
+    return context_set_queue_byte_budget(instance, max_bytes);
+}
+
+__attribute__((visibility("default")))
+void plugin_instance_attach(void* instance, const char* (*next_place_message)(void*, message_t*), void* next_instance){
+    plugin_context_t* ctx = instance;
+    ctx->next_place_message = next_place_message;
+    ctx->next_instance = next_instance;
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_wait_finished(void* instance){
+    return context_wait_finished(instance);
+}
+
+__attribute__((visibility("default")))
+const char* plugin_instance_destroy(void* instance){
+    const char* err = context_fini(instance);
+    free(instance);
+    return err;
+}
@@ -1,8 +1,78 @@
 #include "sync/consumer_producer.h"
+#include "sync/stage_stats.h"
+#include "sync/probes.h"
+#include "plugin_host.h"
 #include <pthread.h>
 /**
  * Common SDK structures and functions for plugin implementation
  */
+// Most downstream transforms one stage can run in its own thread
+#define PLUGIN_MAX_FUSED 16
+// Log levels, most severe first
+#define PLUGIN_LOG_ERROR 0
+#define PLUGIN_LOG_WARN 1
+#define PLUGIN_LOG_INFO 2
+#define PLUGIN_LOG_DEBUG 3
+// Most verbose level compiled in; calls above it generate no code at all.
+// Release builds (-DNDEBUG) keep warnings and errors, override with
+// -DPLUGIN_LOG_MAX=<level>
+#ifndef PLUGIN_LOG_MAX
+#ifdef NDEBUG
+#define PLUGIN_LOG_MAX PLUGIN_LOG_WARN
+#else
+#define PLUGIN_LOG_MAX PLUGIN_LOG_DEBUG
+#endif
+#endif
+// Log through plugin_log when level is compiled in and enabled at runtime
+// (ANALYZER_LOG_LEVEL). Arguments are only evaluated when the message is
+// printed, so a disabled call costs one compare
+#define PLUGIN_LOG(ctx, level, ...) \
+    do { \
+        if ((level) <= PLUGIN_LOG_MAX && (level) <= plugin_log_level) { \
+            plugin_log((ctx), (level), __VA_ARGS__); \
+        } \
+    } while (0)
+#define LOG_ERROR(ctx, ...) PLUGIN_LOG(ctx, PLUGIN_LOG_ERROR, __VA_ARGS__)
+#define LOG_WARN(ctx, ...) PLUGIN_LOG(ctx, PLUGIN_LOG_WARN, __VA_ARGS__)
+#define LOG_INFO(ctx, ...) PLUGIN_LOG(ctx, PLUGIN_LOG_INFO, __VA_ARGS__)
+#define LOG_DEBUG(ctx, ...) PLUGIN_LOG(ctx, PLUGIN_LOG_DEBUG, __VA_ARGS__)
+// Record a PLUGIN_TRACE_* event in the host's binary trace when it is on;
+// a ring write, no formatting, so it is cheap enough for every item
+#define PLUGIN_TRACE(ctx, event, arg0, arg1) \
+    do { \
+        if ((ctx)->trace_id >= 0) { \
+            (ctx)->host->trace((ctx)->trace_id, (event), (arg0), (arg1)); \
+        } \
+    } while (0)
+// One stage's transform as run by a consumer thread
+typedef struct
+{
+ const char* (*transform)(const char*); // Returns the input or a new buffer
+ void (*transform_inplace)(char*, size_t); // Length-preserving in-place variant, NULL if the plugin has none
+ message_t* (*transform_v2)(message_t*); // Message variant, NULL if the plugin has none
+} plugin_stage_fn_t;
+// Reorder slot of a worker pool
+typedef struct
+{
+ message_t* item; // Transformed item waiting for its turn
+ int state; // PLUGIN_SLOT_* in plugin_common.c
+} plugin_pool_slot_t;
+// Worker pool: several consumer threads on one stage queue. Items get
+// sequence numbers in dequeue order and leave through a reorder window, so
+// the next stage still sees them in input order
+typedef struct
+{
+ pthread_t* threads; // Worker threads
+ int count; // Number of workers
+ pthread_mutex_t take_lock; // Serializes dequeue and sequence numbering
+ pthread_mutex_t emit_lock; // Guards the reorder window, serializes forwarding
+ pthread_cond_t window_cond; // Signaled when the window moves
+ size_t next_take; // Sequence number of the next dequeued item
+ size_t next_emit; // Sequence number of the next item to forward
+ size_t window; // Number of reorder slots
+ plugin_pool_slot_t* slots; // Reorder window, indexed by sequence % window
+ int ended; // END was dequeued, stop taking items
+} plugin_pool_t;
 // Plugin context structure
 typedef struct
 {
@@ -10,9 +80,31 @@ typedef struct
  consumer_producer_t* queue; // Input queue
  pthread_t consumer_thread; // Consumer thread
  const char* (*next_place_work)(const char*); // Next plugin's place_work function
+ const char* (*next_place_message)(void*, message_t*); // Next stage's plugin_instance_place_message (instance ABI)
+ void* next_instance; // Next stage's instance handle, NULL when attached through plugin_attach
  const char* (*process_function)(const char*); // Plugin-specific processing function
+ void (*process_inplace)(char*, size_t); // The plugin's plugin_transform_inplace, NULL if it has none
+ message_t* (*process_message)(message_t*); // The plugin's plugin_transform_v2, NULL if it has none
+ void (*process_control)(message_kind_t); // The plugin's plugin_control, NULL if it has none
+ void (*process_idle)(void); // The plugin's plugin_idle, NULL if it has none
  int initialized; // Initialization flag
  int finished; // Finished processing flag
+ const plugin_host_t* host; // Host services, NULL when started by plain plugin_init
+ int trace_id; // Source id in the host's binary trace, -1 when tracing is off
+ stage_stats_t* stats; // Counters in the host's --stats table, NULL when stats are off
+ uint64_t stats_mark; // When the last transform ended, which is when its forward starts (one-thread stages, --stats only)
+ plugin_stage_fn_t fused[PLUGIN_MAX_FUSED]; // Transforms of fused downstream stages, run in order after process_function
+ int fused_count; // Number of entries in fused
+ int workers; // Consumer threads requested for this stage (1 = plain consumer thread)
+ plugin_pool_t* pool; // Worker pool when workers > 1, NULL otherwise
+ int task; // Stage runs as a task on the host's pool (host->schedule) instead of its own thread
+ atomic_int task_state; // PLUGIN_TASK_* in plugin_common.c
+ message_t* stalled; // Item the task could not hand on yet (next stage full)
+ int stalled_end; // The item being handed on is END
+ uint64_t stalled_at; // When the task first tried to hand on a data item (--stats only)
+ int (*next_try_place)(void*, message_t*); // Next stage's plugin_instance_try_place_message (task stages only)
+ void (*next_park)(void*, void (*)(void*), void*); // Next stage's plugin_instance_park_producer, NULL if it has none
+ pthread_cond_t done; // Signaled (under mutex) when a task stage has finished
  pthread_mutex_t mutex;
 } plugin_context_t;
 /**
@@ -22,6 +114,49 @@ typedef struct
  * @return NULL
  */
 void* plugin_consumer_thread(void* arg);
+/**
+ * Worker pool thread function, used instead of plugin_consumer_thread when a
+ * stage runs more than one worker
+ * @param arg Pointer to plugin_context_t
+ * @return NULL
+ */
+void* plugin_pool_worker_thread(void* arg);
+/**
+ * Allocate a message buffer that any stage may free (host allocator when one
+ * was attached, this plugin's malloc otherwise). Transforms must allocate
+ * the strings they return with this.
+ * @param size Number of bytes
+ * @return The buffer, or NULL on failure
+ */
+void* plugin_alloc(size_t size);
+/**
+ * Free a buffer obtained from plugin_alloc or received from the pipeline
+ * @param ptr Buffer to free (NULL is ignored)
+ */
+void plugin_free(void* ptr);
+/**
+ * Allocate a message that any stage may free. Message transforms must
+ * allocate the messages they return with this.
+ * @param cap Payload capacity in bytes
+ * @return The message (len 0), or NULL on failure
+ */
+message_t* plugin_message_alloc(size_t cap);
+/**
+ * Free a message from plugin_message_alloc or received from the pipeline
+ * @param msg Message to free (NULL is ignored)
+ */
+void plugin_message_free(message_t* msg);
+// Runtime log level (PLUGIN_LOG_*), read from ANALYZER_LOG_LEVEL when the
+// first stage starts; defaults to PLUGIN_LOG_WARN
+extern int plugin_log_level __attribute__((visibility("hidden")));
+/**
+ * Print a log line in the format [LEVEL][Plugin Name] - message to stderr.
+ * Use the LOG_* macros instead, they skip the call when the level is off
+ * @param context Plugin context
+ * @param level PLUGIN_LOG_* level of the message
+ * @param format printf format of the message
+ */
+void plugin_log(const plugin_context_t* context, int level, const char* format, ...) __attribute__((format(printf, 3, 4)));
 /**
  * Print error message in the format [ERROR][Plugin Name] - message
  * @param context Plugin context
@@ -40,6 +175,49 @@ void log_info(plugin_context_t* context, const char* message);
  */
 __attribute__((visibility("default")))
 const char* plugin_get_name(void);
+/**
+ * Get the plugin's capabilities (optional export, implemented by plugins that
+ * have any; a plugin without it is treated as stateful)
+ * @return Bitmask of PLUGIN_CAP_* flags
+ */
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void);
+/**
+ * Transform a buffer in place (optional export, for transforms that never
+ * change the length). Used instead of plugin_transform whenever the
+ * framework owns the item, which saves an allocation and a copy per item
+ * @param buf The item, modified in place
+ * @param len Payload length in bytes (may contain NULs)
+ */
+__attribute__((visibility("default")))
+void plugin_transform_inplace(char* buf, size_t len);
+/**
+ * Transform a message (optional export, preferred over plugin_transform).
+ * Works on lengths instead of NUL terminators, so payloads may contain NULs.
+ * Borrows input and returns either input itself or a new message from
+ * plugin_message_alloc; NULL drops the item
+ * @param input The message to transform
+ * @return The transformed message, or NULL
+ */
+__attribute__((visibility("default")))
+message_t* plugin_transform_v2(message_t* input);
+/**
+ * React to a FLUSH, STATS or END control message (optional export). Called on
+ * the stage's thread when the message reaches the stage, after every item
+ * queued before it; the framework forwards the message afterwards. END is the
+ * last thing the stage sees
+ * @param kind MESSAGE_FLUSH, MESSAGE_STATS or MESSAGE_END
+ */
+__attribute__((visibility("default")))
+void plugin_control(message_kind_t kind);
+/**
+ * The stage's queue has run dry (optional export). Called on the stage's
+ * thread (or task) after it has handled everything queued so far, before it
+ * waits for more; a plugin that batches its output writes it out here.
+ * Not called for stages with several workers
+ */
+__attribute__((visibility("default")))
+void plugin_idle(void);
 /**
  * Initialize the common plugin infrastructure with the specified queue size
  * @param process_function Plugin-specific processing function
@@ -57,6 +235,16 @@ common_plugin_init
  */
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size);
+/**
+ * Initialize the plugin with host-provided services, then call plugin_init.
+ * Switches the plugin to the host ownership contract (see plugin_host.h):
+ * place_work takes ownership of buffers from host->alloc, nothing is copied
+ * @param host Host services (must outlive the plugin)
+ * @param queue_size Maximum number of items that can be queued
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_init_with_host(const plugin_host_t* host, int queue_size);
 /**
  * Finalize the plugin - drain queue and terminate thread gracefully (i.e.
 pthread_join)
@@ -72,6 +260,14 @@ new memory)
  */
 __attribute__((visibility("default")))
 const char* plugin_place_work(const char* str);
+/**
+ * Bound the plugin's input queue by total payload bytes as well as by item
+ * count (optional export, call after plugin_init and before any work)
+ * @param max_bytes Byte budget (0 = bounded by item count only)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_set_queue_byte_budget(size_t max_bytes);
 /**
  * Attach this plugin to the next plugin in the chain
  * @param next_place_work Function pointer to the next plugin's place_work
@@ -86,4 +282,126 @@ shutdown
  * @return NULL on success, error message on failure
  */
 __attribute__((visibility("default")))
-const char* plugin_wait_finished(void);
\ No newline at end of file
+const char* plugin_wait_finished(void);
+/**
+ * Create an independent instance of this plugin (instance ABI). One loaded
+ * .so can serve any number of stages this way; each instance has its own
+ * queue and consumer thread. Instances always follow the host ownership
+ * contract (see plugin_host.h)
+ * @param host Host services (must outlive the instance)
+ * @param queue_size Maximum number of items that can be queued
+ * @param instance Receives the instance handle on success
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_create(const plugin_host_t* host, int queue_size, void** instance);
+/**
+ * Create an instance whose stage runs several worker threads on its queue.
+ * Output order is preserved. Only meant for plugins that report
+ * PLUGIN_CAP_STATELESS
+ * @param host Host services (must outlive the instance)
+ * @param queue_size Maximum number of items that can be queued
+ * @param workers Number of worker threads (1 behaves like plugin_instance_create)
+ * @param instance Receives the instance handle on success
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_create_workers(const plugin_host_t* host, int queue_size, int workers, void** instance);
+/**
+ * Fuse a downstream stage into this instance: its transform runs on this
+ * instance's thread right after ours, with no queue in between. The host only
+ * fuses plugins that report PLUGIN_CAP_FUSABLE (and PLUGIN_CAP_STATELESS when
+ * this instance has workers), and none that export plugin_control or plugin_idle
+ * @param instance Instance handle (before any work is placed)
+ * @param transform The downstream plugin's plugin_transform
+ * @param transform_inplace The downstream plugin's plugin_transform_inplace, or NULL
+ * @param transform_v2 The downstream plugin's plugin_transform_v2, or NULL
+ * @return NULL on success, error message when no more stages can be fused
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_fuse(void* instance, const char* (*transform)(const char*), void (*transform_inplace)(char*, size_t), message_t* (*transform_v2)(message_t*));
+/**
+ * Bind host services without starting a stage, so that plugin_transform can
+ * be called directly from another stage's thread (fused stages)
+ * @param host Host services (must outlive the plugin)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_set_host(const plugin_host_t* host);
+/**
+ * Place work into an instance's queue (takes ownership of str)
+ * @param instance Instance handle
+ * @param str The string to process
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_place_work(void* instance, const char* str);
+/**
+ * Place a message into an instance's queue only if there is room right now
+ * (never waits). Used by stages that run as tasks on the host's thread pool,
+ * where a waiting producer could hold the thread its consumer needs
+ * @param instance Instance handle
+ * @param msg Message allocated with the host allocator
+ * @return 1 if the instance took msg, 0 if its queue is full (msg stays the caller's)
+ */
+__attribute__((visibility("default")))
+int plugin_instance_try_place_message(void* instance, message_t* msg);
+/**
+ * Park a producer that found the queue full (see
+ * plugin_instance_try_place_message): wake(arg) is called once, on the
+ * consumer's thread, as soon as the stage takes an item from its queue
+ * @param instance Instance handle
+ * @param wake Called when there is room again; must not block
+ * @param arg Passed to wake
+ */
+__attribute__((visibility("default")))
+void plugin_instance_park_producer(void* instance, void (*wake)(void*), void* arg);
+/**
+ * Make a task stage hand items to its next stage without waiting; the host
+ * calls this after plugin_instance_attach for every stage that runs as a task
+ * @param instance Instance handle
+ * @param next_try_place_message The next stage's plugin_instance_try_place_message
+ * @param next_park The next stage's plugin_instance_park_producer, or NULL: a
+ * task that finds the next stage full then parks until it takes an item,
+ * rather than being requeued behind it
+ */
+__attribute__((visibility("default")))
+void plugin_instance_attach_task(void* instance, int (*next_try_place_message)(void*, message_t*), void (*next_park)(void*, void (*)(void*), void*));
+/**
+ * Place a message into an instance's queue (takes ownership of msg)
+ * @param instance Instance handle
+ * @param msg Message allocated with the host allocator (see message_new)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_place_message(void* instance, message_t* msg);
+/**
+ * Bound an instance's input queue by total payload bytes
+ * @param instance Instance handle
+ * @param max_bytes Byte budget (0 = bounded by item count only)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_set_queue_byte_budget(void* instance, size_t max_bytes);
+/**
+ * Attach an instance to the next stage's instance
+ * @param instance Instance handle
+ * @param next_place_message The next stage's plugin_instance_place_message
+ * @param next_instance The next stage's instance handle
+ */
+__attribute__((visibility("default")))
+void plugin_instance_attach(void* instance, const char* (*next_place_message)(void*, message_t*), void* next_instance);
+/**
+ * Wait until an instance has finished processing all work
+ * @param instance Instance handle
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_wait_finished(void* instance);
+/**
+ * Finalize an instance and release its handle
+ * @param instance Instance handle (invalid afterwards)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_destroy(void* instance);
\ No newline at end of file
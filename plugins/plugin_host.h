@@ -0,0 +1,55 @@
+#include <stddef.h>
+#include <stdint.h>
+struct stage_stats;
+/**
+ * Services the host (analyzer) hands to every plugin at init
+ *
+ * Ownership contract for message buffers when a host is attached:
+ *  - Every buffer that travels between stages is allocated with host->alloc
+ *    and released with host->free. Both are thread-safe and may be called
+ *    from any plugin, because the host's heap is shared by all of them
+ *    (each plugin's own malloc/free belongs to its private libc copy).
+ *  - plugin_place_work(str) takes ownership of str on every call, whether it
+ *    succeeds or fails; the caller must not touch str afterwards. No copy is
+ *    made anywhere on the way into the next stage's queue.
+ *  - plugin_transform(input) borrows input. It either returns input itself
+ *    (pass-through stages, zero copies) or a new buffer from plugin_alloc, in
+ *    which case the framework frees input.
+ * Without a host (plain plugin_init) the legacy rules apply: place_work copies
+ * its argument and the caller keeps ownership of the original.
+ */
+typedef struct
+{
+    void* (*alloc)(size_t size); /* Allocate a message buffer */
+    void (*free)(void* ptr); /* Free a buffer from alloc (any thread, any plugin) */
+    int (*trace_source)(const char* name); /* Register a stage with the binary trace, returns its id; NULL when tracing is off */
+    void (*trace)(int source, int event, uint64_t arg0, uint64_t arg1); /* Record a PLUGIN_TRACE_* event on the calling thread's ring */
+    int (*thread_cpu)(void); /* CPU to pin the next stage thread to, -1 to leave it unpinned; NULL when placement is off */
+    void (*schedule)(void (*run)(void*), void* arg, int later); /* Run a task on the host's thread pool (later: behind queued work); when set, the stage runs as a task instead of on a thread of its own */
+    struct stage_stats* (*stats)(const char* name); /* Register a stage for the --stats table, returns its counters (sync/stage_stats.h); NULL when stats are off */
+} plugin_host_t;
+
+/**
+ * Binary trace events recorded by the plugin framework (analyzer --trace=FILE);
+ * trace_decode renders them as the framework's [LEVEL][name] - message lines
+ */
+enum
+{
+    PLUGIN_TRACE_INIT = 0, /* Stage initialized */
+    PLUGIN_TRACE_ITEM, /* Item taken from the queue (args: length, message address) */
+    PLUGIN_TRACE_RESULT, /* Item transformed (args: length) */
+    PLUGIN_TRACE_FORWARD, /* Item about to be handed to the next stage (args: 0, message address) */
+    PLUGIN_TRACE_LAST_STAGE, /* Item freed by the last stage */
+    PLUGIN_TRACE_CONTROL, /* Control message passed (args: message_kind_t) */
+    PLUGIN_TRACE_DROP, /* Transform failed, item dropped */
+    PLUGIN_TRACE_FINISHED, /* Stage thread finished */
+    PLUGIN_TRACE_FORWARDED, /* The next stage's queue took the item */
+    PLUGIN_TRACE_EVENT_COUNT
+};
+
+/**
+ * Capability bits a plugin reports through plugin_get_capabilities
+ */
+#define PLUGIN_CAP_STATELESS 0x1u /* Transform keeps no state between items: safe to run replicated */
+#define PLUGIN_CAP_FUSABLE 0x2u /* plugin_transform never blocks and may run on another stage's thread (behind a pool only if also STATELESS; never with plugin_control/plugin_idle) */
+#define PLUGIN_CAP_NONBLOCKING 0x4u /* Transforms never sleep or wait: the stage may run as a task on a shared thread pool */
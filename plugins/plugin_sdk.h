@@ -1,14 +1,33 @@
+#include <stddef.h>
+#include "plugin_host.h"
+#include "sync/message.h"
 /**
  * Get the plugin's name
  * @return The plugin's name (should not be modified or freed)
  */
 const char* plugin_get_name(void);
+/**
+ * Get the plugin's capabilities. Optional: a plugin that does not export it
+ * is treated as stateful and never replicated
+ * @return Bitmask of PLUGIN_CAP_* flags (see plugin_host.h)
+ */
+unsigned plugin_get_capabilities(void);
 /**
  * Initialize the plugin with the specified queue size
  * @param queue_size Maximum number of items that can be queued
  * @return NULL on success, error message on failure
  */
 const char* plugin_init(int queue_size);
+/**
+ * Initialize the plugin with host-provided services (allocator) and the
+ * specified queue size. Optional: when every plugin in the chain exports it,
+ * the host uses it instead of plugin_init and buffers move between stages
+ * without copies under the ownership contract described in plugin_host.h
+ * @param host Host services (outlive the plugin)
+ * @param queue_size Maximum number of items that can be queued
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_init_with_host(const plugin_host_t* host, int queue_size);
 /**
  * Finalize the plugin - terminate thread gracefully
  * @return NULL on success, error message on failure
@@ -17,10 +36,18 @@ const char* plugin_fini(void);
 /**
  * Place work (a string) into the plugin's queue
  * @param str The string to process (plugin takes ownership if it allocates
-new memory)
+new memory; always, when initialized through plugin_init_with_host)
  * @return NULL on success, error message on failure
  */
 const char* plugin_place_work(const char* str);
+/**
+ * Bound the plugin's input queue by total payload bytes as well as by item
+ * count. Optional: the host only requires it when a byte budget is requested.
+ * Called after plugin_init and before any work is placed.
+ * @param max_bytes Byte budget (0 = bounded by item count only)
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_set_queue_byte_budget(size_t max_bytes);
 /**
  * Attach this plugin to the next plugin in the chain
  * @param next_place_work Function pointer to the next plugin's place_work
@@ -33,4 +60,111 @@ shutdown
  * This is a blocking function used for graceful shutdown coordination
  * @return NULL on success, error message on failure
  */
-const char* plugin_wait_finished(void);
\ No newline at end of file
+const char* plugin_wait_finished(void);
+/**
+ * Instance ABI (optional). When every plugin in the chain exports these, the
+ * host loads each .so once and creates one instance per stage instead of
+ * loading a private copy of the plugin (and its libc) for every stage.
+ * Instances always follow the host ownership contract in plugin_host.h.
+ * @param host Host services (outlive the instance)
+ * @param queue_size Maximum number of items that can be queued
+ * @param instance Receives the instance handle on success
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_instance_create(const plugin_host_t* host, int queue_size, void** instance);
+/**
+ * Like plugin_instance_create, but the stage runs workers threads on its
+ * queue and still forwards items in input order. Only used for plugins that
+ * report PLUGIN_CAP_STATELESS
+ */
+const char* plugin_instance_create_workers(const plugin_host_t* host, int queue_size, int workers, void** instance);
+/**
+ * Transform one item (borrowed input, see plugin_host.h). Required for
+ * plugins that report PLUGIN_CAP_FUSABLE: the host may skip such a stage's
+ * queue and thread and call this directly on the previous stage's thread.
+ * Behind a name:N stage that means on N threads at once, so there the host
+ * also requires PLUGIN_CAP_STATELESS. A fused stage gets no plugin_control or
+ * plugin_idle calls, so plugins exporting either are never fused
+ */
+const char* plugin_transform(const char* input);
+/**
+ * Transform a message (optional, preferred over plugin_transform). Works on
+ * lengths, so payloads may contain NULs. Borrows input and returns input
+ * itself or a new message; NULL drops the item
+ * @param input The message to transform
+ * @return The transformed message, or NULL
+ */
+message_t* plugin_transform_v2(message_t* input);
+/**
+ * React to a FLUSH, STATS or END control message (optional). Control messages
+ * travel in stream order but never reach a transform, so a payload that reads
+ * "<END>" is ordinary data; only plugin_place_work still turns that exact
+ * string into an end-of-stream marker, for string-based callers
+ * @param kind MESSAGE_FLUSH, MESSAGE_STATS or MESSAGE_END (the last one a stage sees)
+ */
+void plugin_control(message_kind_t kind);
+/**
+ * Called when the stage has handled all of its queued input and is about to
+ * wait for more (optional). A plugin that batches output flushes it here
+ */
+void plugin_idle(void);
+/**
+ * Transform a buffer in place (optional, length-preserving transforms only).
+ * Preferred over plugin_transform whenever the framework owns the item
+ * @param buf The item, modified in place
+ * @param len Payload length in bytes (may contain NULs)
+ */
+void plugin_transform_inplace(char* buf, size_t len);
+/**
+ * Bind host services without starting a stage, before plugin_transform is
+ * called directly by a fused stage
+ */
+const char* plugin_set_host(const plugin_host_t* host);
+/**
+ * Run a downstream plugin's transform (and its in-place and message
+ * variants, if any) on this instance's thread after its own; fails once the
+ * instance cannot fuse more stages
+ */
+const char* plugin_instance_fuse(void* instance, const char* (*transform)(const char*), void (*transform_inplace)(char*, size_t), message_t* (*transform_v2)(message_t*));
+/**
+ * Place work into an instance's queue; takes ownership of str
+ */
+const char* plugin_instance_place_work(void* instance, const char* str);
+/**
+ * Place a message into an instance's queue; takes ownership of msg, which
+ * must come from the host allocator
+ */
+const char* plugin_instance_place_message(void* instance, message_t* msg);
+/**
+ * Like plugin_instance_place_message, but only if the queue has room right
+ * now: returns 1 when the instance took msg, 0 when msg is still the caller's
+ */
+int plugin_instance_try_place_message(void* instance, message_t* msg);
+/**
+ * After plugin_instance_try_place_message found the queue full: call
+ * wake(arg) once, on the consumer's thread, when the stage takes an item
+ */
+void plugin_instance_park_producer(void* instance, void (*wake)(void*), void* arg);
+/**
+ * For a stage the host runs as a task (host->schedule set, see
+ * PLUGIN_CAP_NONBLOCKING): hand items to the next stage through its
+ * plugin_instance_try_place_message, so the task never waits, and park on
+ * its plugin_instance_park_producer (if not NULL) while it is full
+ */
+void plugin_instance_attach_task(void* instance, int (*next_try_place_message)(void*, message_t*), void (*next_park)(void*, void (*)(void*), void*));
+/**
+ * Bound an instance's input queue by total payload bytes
+ */
+const char* plugin_instance_set_queue_byte_budget(void* instance, size_t max_bytes);
+/**
+ * Attach an instance to the next stage (its plugin_instance_place_message and handle)
+ */
+void plugin_instance_attach(void* instance, const char* (*next_place_message)(void*, message_t*), void* next_instance);
+/**
+ * Wait until an instance has finished processing all work
+ */
+const char* plugin_instance_wait_finished(void* instance);
+/**
+ * Finalize an instance and release its handle
+ */
+const char* plugin_instance_destroy(void* instance);
\ No newline at end of file
@@ -1,10 +1,18 @@
 #include "plugin_common.h"
+#include <string.h>
 const char* plugin_transform(const char* input){
     if(input == NULL){
         return NULL;
     }
     int len = strlen(input);
-    char* result = malloc(len+1);
+    char* result = plugin_alloc(len+1);
+    if(result == NULL){
+        return NULL;
+    }
+    if(len == 0){
+        result[0] = '\0';
+        return result;
+    }
     result[0] = input[len-1];
     for (int i = 0; i < len-1; i++) {
         result[i+1] = input[i];
@@ -13,7 +21,22 @@ const char* plugin_transform(const char* input){
     return result;
 }
 
+__attribute__((visibility("default")))
+void plugin_transform_inplace(char* buf, size_t len){
+    if (len < 2) {
+        return;
+    }
+    char last = buf[len-1];
+    memmove(buf+1, buf, len-1);
+    buf[0] = last;
+}
+
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size){
     return common_plugin_init(plugin_transform, "rotator", queue_size);
+}
+
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void){
+    return PLUGIN_CAP_STATELESS | PLUGIN_CAP_FUSABLE | PLUGIN_CAP_NONBLOCKING;
 }
\ No newline at end of file
@@ -1,36 +1,86 @@
 #include "consumer_producer.h"
+#include "stage_stats.h"
+#include "probes.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sched.h>
 
 //global variables 
 
+static inline char* ring_try_pop(consumer_producer_t* queue);
+static void release_item(consumer_producer_t* queue, char* item);
+
 const char* consumer_producer_init(consumer_producer_t* queue, int capacity){
+    return consumer_producer_init_backend(queue, capacity, CP_BACKEND_MUTEX);
+}
+
+const char* consumer_producer_init_backend(consumer_producer_t* queue, int capacity, consumer_producer_backend_t backend){
     //1. check if the capacity is valid 
     if(capacity <= 0){
         fprintf(stderr, "[ERROR] The capacity is not valid\n");
         return "The capacity is not valid";
     }
-    //4. allocate memory for sizeof(char**)*capacity 
-    queue->items = calloc(capacity, sizeof(char*));
-    if (queue->items == NULL) {
-        fprintf(stderr, "[ERROR] Failed to allocate item buffer\n");
-        return "Memory allocation failed";
+    queue->backend = backend;
+    queue->items = NULL;
+    queue->ring = NULL;
+    queue->mpmc = NULL;
+    if(backend == CP_BACKEND_SPSC){
+        queue->ring = aligned_alloc(SPSC_CACHE_LINE, sizeof(spsc_ring_t));
+        if(queue->ring == NULL || spsc_ring_init(queue->ring, capacity) != 0){
+            fprintf(stderr, "[ERROR] Failed to allocate ring buffer\n");
+            free(queue->ring);
+            return "Memory allocation failed";
+        }
+    }else if(backend == CP_BACKEND_MPMC){
+        queue->mpmc = aligned_alloc(MPMC_CACHE_LINE, sizeof(mpmc_ring_t));
+        if(queue->mpmc == NULL || mpmc_ring_init(queue->mpmc, capacity) != 0){
+            fprintf(stderr, "[ERROR] Failed to allocate ring buffer\n");
+            free(queue->mpmc);
+            return "Memory allocation failed";
+        }
+    }else{
+        //4. allocate memory for sizeof(char**)*capacity 
+        queue->items = calloc(capacity, sizeof(char*));
+        if (queue->items == NULL) {
+            fprintf(stderr, "[ERROR] Failed to allocate item buffer\n");
+            return "Memory allocation failed";
+        }
     }
+    atomic_init(&queue->empty_waiters, 0);
+    atomic_init(&queue->full_waiters, 0);
+    atomic_init(&queue->parked, NULL);
     //2. set the capacity if the queue 
     queue->capacity = capacity;
     //3. set count,head,tail to zero (no items yet)
     queue->count = 0;
     queue->head= 0;
     queue->tail= 0;
-    queue->is_finished=false;
+    atomic_init(&queue->is_finished, false);
+    queue->spin_count = 0;
+    queue->max_bytes = 0;
+    atomic_init(&queue->bytes, 0);
+    queue->alloc_item = malloc;
+    queue->free_item = free;
+    queue->messages = false;
+    queue->stamp = false;
     pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
     //5. initialize 3 monitors not_full_monitor,not_empty_monitor,finished_monitor
     if(monitor_init(&queue->finished_monitor) != 0 || monitor_init(&queue->not_empty_monitor) != 0  || monitor_init(&queue->not_full_monitor) != 0){
         fprintf(stderr, "[ERROR] Failed to create one of finished_monitor,not_empty_monitor,not_full_monitor \n");
         free(queue->items);
+        if(queue->ring != NULL){
+            spsc_ring_destroy(queue->ring);
+            free(queue->ring);
+        }
+        if(queue->mpmc != NULL){
+            mpmc_ring_destroy(queue->mpmc);
+            free(queue->mpmc);
+        }
         return "Failed to create one of finished_monitor,not_empty_monitor,not_full_monitor";
     }
     return NULL; 
@@ -45,73 +95,577 @@ void consumer_producer_destroy(consumer_producer_t* queue){
     //TODO : check if destroy succeeded
 
     //2. free all the space of the items(array)
-    for(int i=0; i< queue->capacity ; i++){
-        if(queue->items[i]!=NULL){
-            free(queue->items[i]);
+    if(queue->backend != CP_BACKEND_MUTEX){
+        //leftover items go back through the queue's own free function
+        char* item;
+        while((item = ring_try_pop(queue)) != NULL){
+            release_item(queue, item);
+        }
+    }
+    if(queue->backend == CP_BACKEND_SPSC){
+        spsc_ring_destroy(queue->ring);
+        free(queue->ring);
+    }else if(queue->backend == CP_BACKEND_MPMC){
+        mpmc_ring_destroy(queue->mpmc);
+        free(queue->mpmc);
+    }else{
+        for(int i=0; i< queue->capacity ; i++){
+            if(queue->items[i]!=NULL){
+                release_item(queue, queue->items[i]);
+            }
         }
+        free(queue->items);
     }
-    free(queue->items);
     pthread_mutex_unlock(&queue->lock);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
     pthread_mutex_destroy(&queue->lock);
 }
 
-const char* consumer_producer_put(consumer_producer_t* queue, const char* item){
-    //1. check if queue is full using not_full_monitor , maybe need to use while and cond_var ?
-    while (1) {
-        pthread_mutex_lock(&queue->lock);
-        if (queue->count < queue->capacity) {
-            char* newItem = strdup(item);
-            if(newItem == NULL){
-                pthread_mutex_unlock(&queue->lock);
-                return "Memory allocation failed for item";
+void consumer_producer_set_spin(consumer_producer_t* queue, int spin_count){
+    queue->spin_count = spin_count > 0 ? spin_count : 0;
+}
+
+void consumer_producer_set_messages(consumer_producer_t* queue){
+    queue->messages = true;
+}
+
+void consumer_producer_set_stamping(consumer_producer_t* queue){
+    queue->stamp = queue->messages;
+}
+
+void consumer_producer_set_allocator(consumer_producer_t* queue, void* (*alloc)(size_t), void (*free_fn)(void*)){
+    queue->alloc_item = alloc != NULL ? alloc : malloc;
+    queue->free_item = free_fn != NULL ? free_fn : free;
+}
+
+//copy a caller-owned string with the queue's allocator
+static char* copy_item(consumer_producer_t* queue, const char* item){
+    size_t size = strlen(item) + 1;
+    char* copy = queue->alloc_item(size);
+    if(copy != NULL){
+        memcpy(copy, item, size);
+    }
+    return copy;
+}
+
+void consumer_producer_set_byte_budget(consumer_producer_t* queue, size_t max_bytes){
+    queue->max_bytes = max_bytes;
+}
+
+//bytes an item occupies in the budget (payload plus terminator, for
+//messages too so a budget means the same for both kinds of queue)
+static inline size_t item_bytes(consumer_producer_t* queue, const char* item){
+    if(queue->messages){
+        return ((const message_t*)item)->len + 1;
+    }
+    return strlen(item) + 1;
+}
+
+//free an item the queue still owns
+static void release_item(consumer_producer_t* queue, char* item){
+    if(queue->messages){
+        message_free((message_t*)item, queue->free_item);
+    }else{
+        queue->free_item(item);
+    }
+}
+
+//whether an item of size bytes may join a queue holding count items and
+//bytes bytes. a single item larger than the whole budget is still let into
+//an empty queue, otherwise it could never move and would stall the pipeline
+static inline bool has_room(consumer_producer_t* queue, size_t count, size_t bytes, size_t size){
+    if(count >= (size_t)queue->capacity){
+        return false;
+    }
+    return queue->max_bytes == 0 || bytes == 0 || bytes + size <= queue->max_bytes;
+}
+
+//hint to the CPU that we are busy-waiting
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+//the lock-free backends (SPSC and MPMC) share everything but the ring itself
+static inline int ring_try_push(consumer_producer_t* queue, char* item){
+    if(queue->backend == CP_BACKEND_SPSC){
+        return spsc_ring_try_push(queue->ring, item);
+    }
+    return mpmc_ring_try_push(queue->mpmc, item);
+}
+
+static inline char* ring_try_pop(consumer_producer_t* queue){
+    if(queue->backend == CP_BACKEND_SPSC){
+        return spsc_ring_try_pop(queue->ring);
+    }
+    return mpmc_ring_try_pop(queue->mpmc);
+}
+
+static inline size_t ring_size(consumer_producer_t* queue){
+    if(queue->backend == CP_BACKEND_SPSC){
+        return spsc_ring_size(queue->ring);
+    }
+    return mpmc_ring_size(queue->mpmc);
+}
+
+//push an item, reserving its bytes first so that concurrent producers can
+//never overshoot the budget together
+static int lockfree_try_push(consumer_producer_t* queue, char* item, size_t size){
+    size_t bytes = atomic_load_explicit(&queue->bytes, memory_order_relaxed);
+    do{
+        if(!has_room(queue, ring_size(queue), bytes, size)){
+            return 0;
+        }
+    }while(!atomic_compare_exchange_weak(&queue->bytes, &bytes, bytes + size));
+    if(!ring_try_push(queue, item)){
+        atomic_fetch_sub(&queue->bytes, size);
+        return 0;
+    }
+    //USDT: queue_put/queue_get(queue, item) as an item goes in or comes out;
+    //pairing them by item gives the handoff latency between two threads
+    ANALYZER_PROBE2(queue_put, queue, item);
+    return 1;
+}
+
+static char* lockfree_try_pop(consumer_producer_t* queue){
+    char* item = ring_try_pop(queue);
+    if(item != NULL){
+        atomic_fetch_sub(&queue->bytes, item_bytes(queue, item));
+        ANALYZER_PROBE2(queue_get, queue, item);
+    }
+    return item;
+}
+
+//wake a parked thread of a lock-free queue, if any. the fence pairs with the
+//one taken before parking in lockfree_wait_not_full/lockfree_wait_not_empty:
+//either the waiter sees our update to the ring, or we see its waiter count
+static void lockfree_wake(atomic_int* waiters, monitor_t* monitor){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiters, memory_order_relaxed) > 0){
+        monitor_signal(monitor);
+    }
+}
+
+//park a producer until the ring has room for size more bytes. announce
+//first, then re-check before sleeping so a concurrent get cannot miss us
+static int lockfree_wait_not_full(consumer_producer_t* queue, size_t size){
+    int rc = 0;
+    //the consumer is usually about to free a slot: spin briefly before parking
+    for(int i = 0; i < queue->spin_count; i++){
+        if(has_room(queue, ring_size(queue), atomic_load(&queue->bytes), size)){
+            return 0;
+        }
+        cpu_relax();
+    }
+    atomic_fetch_add(&queue->full_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(!has_room(queue, ring_size(queue), atomic_load(&queue->bytes), size)){
+        rc = monitor_wait(&queue->not_full_monitor);
+    }
+    atomic_fetch_sub(&queue->full_waiters, 1);
+    return rc;
+}
+
+//park a consumer until the ring has an item
+//returns -1 once the queue is finished and drained (or waiting failed)
+static int lockfree_wait_not_empty(consumer_producer_t* queue){
+    int rc = 0;
+    for(int i = 0; i < queue->spin_count; i++){
+        if(ring_size(queue) > 0 || atomic_load(&queue->is_finished)){
+            break;
+        }
+        cpu_relax();
+    }
+    atomic_fetch_add(&queue->empty_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    //read is_finished before the ring: anything put before the finish signal
+    //is then guaranteed to be visible to the size check
+    bool finished = atomic_load(&queue->is_finished);
+    if(ring_size(queue) == 0){
+        if(finished){
+            //the finish signal wakes one consumer; pass it on to the next one
+            monitor_signal(&queue->not_empty_monitor);
+            rc = -1;
+        }else{
+            rc = monitor_wait(&queue->not_empty_monitor);
+        }
+    }else if(queue->backend == CP_BACKEND_MPMC){
+        //a producer claimed a slot but has not published it yet; let it run
+        sched_yield();
+    }
+    atomic_fetch_sub(&queue->empty_waiters, 1);
+    return rc;
+}
+
+//note when messages about to go in entered the queue; after a wait for room
+//they are stamped again, so the wait counts as the producer's, not as queueing
+static inline void stamp_items(consumer_producer_t* queue, char** items, int count){
+    if(queue->stamp){
+        uint64_t now = stage_stats_now();
+        for(int i = 0; i < count; i++){
+            ((message_t*)items[i])->queued_at = now;
+        }
+    }
+}
+
+static const char* lockfree_put_batch(consumer_producer_t* queue, char** newItems, int count){
+    int placed = 0;
+    while(placed < count){
+        stamp_items(queue, newItems + placed, count - placed);
+        int pushed = 0;
+        size_t size = item_bytes(queue, newItems[placed]);
+        while(lockfree_try_push(queue, newItems[placed], size)){
+            placed++;
+            pushed++;
+            if(placed == count){
+                break;
+            }
+            size = item_bytes(queue, newItems[placed]);
+        }
+        if(pushed > 0){
+            lockfree_wake(&queue->empty_waiters, &queue->not_empty_monitor);
+            //a monitor wakes one thread per signal: if there is still room,
+            //let the next parked producer in as well (MPMC only)
+            if(queue->backend == CP_BACKEND_MPMC && has_room(queue, ring_size(queue), atomic_load(&queue->bytes), 1)){
+                lockfree_wake(&queue->full_waiters, &queue->not_full_monitor);
             }
-            queue->items[queue->tail] = newItem;
-            //3. change tail = tail+1
+        }
+        if(placed < count && lockfree_wait_not_full(queue, size) != 0){
+            for(int i = placed; i < count; i++){
+                release_item(queue, newItems[i]);
+            }
+            return "Wait for not full monitor failed";
+        }
+    }
+    return NULL;
+}
+
+//take what is there (up to max_items) without waiting, wake producers once
+static int lockfree_take(consumer_producer_t* queue, char** out, int max_items){
+    int n = 0;
+    char* item;
+    while(n < max_items && (item = lockfree_try_pop(queue)) != NULL){
+        out[n++] = item;
+    }
+    if(n > 0){
+        lockfree_wake(&queue->full_waiters, &queue->not_full_monitor);
+        if(queue->backend == CP_BACKEND_MPMC && ring_size(queue) > 0){
+            lockfree_wake(&queue->empty_waiters, &queue->not_empty_monitor);
+        }
+    }
+    return n;
+}
+
+static int lockfree_get_batch(consumer_producer_t* queue, char** out, int max_items){
+    while(1){
+        int n = lockfree_take(queue, out, max_items);
+        if(n > 0){
+            return n;
+        }
+        if(lockfree_wait_not_empty(queue) != 0){
+            return 0;
+        }
+    }
+}
+
+//copy caller-owned strings up front so no allocation happens under the lock
+static char** dup_items(consumer_producer_t* queue, const char* const* items, int count){
+    char** newItems = malloc(sizeof(char*) * count);
+    if(newItems == NULL){
+        return NULL;
+    }
+    for(int i = 0; i < count; i++){
+        newItems[i] = copy_item(queue, items[i]);
+        if(newItems[i] == NULL){
+            for(int j = 0; j < i; j++){
+                queue->free_item(newItems[j]);
+            }
+            free(newItems);
+            return NULL;
+        }
+    }
+    return newItems;
+}
+
+//wake threads parked on cond after n items (or slots) became available.
+//only touches the condition variable when somebody is actually waiting
+static void mutex_wake(pthread_cond_t* cond, atomic_int* waiters, int n){
+    int waiting = atomic_load_explicit(waiters, memory_order_relaxed);
+    if(waiting == 0){
+        return;
+    }
+    if(n > 1 && waiting > 1){
+        pthread_cond_broadcast(cond);
+    }else{
+        pthread_cond_signal(cond);
+    }
+}
+
+//spin without the lock until the awaited state (a free slot or an item) may
+//hold. count is only read here as a hint; the caller re-checks it under the lock
+static void mutex_spin(consumer_producer_t* queue, bool want_space, size_t size){
+    for(int i = 0; i < queue->spin_count; i++){
+        int count = __atomic_load_n(&queue->count, __ATOMIC_RELAXED);
+        size_t bytes = atomic_load_explicit(&queue->bytes, memory_order_relaxed);
+        if(want_space ? has_room(queue, count, bytes, size) : (count > 0 || atomic_load(&queue->is_finished))){
+            return;
+        }
+        cpu_relax();
+    }
+}
+
+static const char* mutex_put_batch(consumer_producer_t* queue, char** newItems, int count){
+    int placed = 0;
+    pthread_mutex_lock(&queue->lock);
+    while (placed < count) {
+        stamp_items(queue, newItems + placed, count - placed);
+        //move as many items as fit, then wake consumers once for all of them
+        int moved = 0;
+        size_t bytes = atomic_load_explicit(&queue->bytes, memory_order_relaxed);
+        size_t size = item_bytes(queue, newItems[placed]);
+        while (has_room(queue, queue->count + moved, bytes, size)) {
+            ANALYZER_PROBE2(queue_put, queue, newItems[placed]);
+            queue->items[queue->tail] = newItems[placed++];
             queue->tail  = (queue->tail+1) % queue->capacity;
-            queue->count++;
-            monitor_signal(&queue->not_empty_monitor);
+            moved++;
+            bytes += size;
+            if (placed == count) {
+                break;
+            }
+            size = item_bytes(queue, newItems[placed]);
+        }
+        if (moved > 0) {
+            __atomic_store_n(&queue->count, queue->count + moved, __ATOMIC_RELAXED);
+            atomic_store_explicit(&queue->bytes, bytes, memory_order_relaxed);
+            mutex_wake(&queue->not_empty, &queue->empty_waiters, moved);
+            continue;
+        }
+        //queue is full (in items or in bytes)
+        if (queue->spin_count > 0) {
             pthread_mutex_unlock(&queue->lock);
-            //4. return NULL if success error else 
-            return NULL;
+            mutex_spin(queue, true, size);
+            pthread_mutex_lock(&queue->lock);
+            if (has_room(queue, queue->count, atomic_load(&queue->bytes), size)) {
+                continue;
+            }
         }
-        pthread_mutex_unlock(&queue->lock);
-        // Now wait until space becomes available
-        if (monitor_wait(&queue->not_full_monitor) != 0) {
-            return "Wait for not full monitor failed";
+        atomic_fetch_add(&queue->full_waiters, 1);
+        int rc = pthread_cond_wait(&queue->not_full, &queue->lock);
+        atomic_fetch_sub(&queue->full_waiters, 1);
+        if (rc != 0) {
+            pthread_mutex_unlock(&queue->lock);
+            for (int i = placed; i < count; i++) {
+                release_item(queue, newItems[i]);
+            }
+            return "Wait for not full condition failed";
         }
     }
-    //2. add to tail+1 of the queue item 
-    
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
 }
 
-char* consumer_producer_get(consumer_producer_t* queue){
-    //1. check if exist an item in the queue 
+//take everything available (up to max_items) and wake producers once;
+//caller holds the lock
+static int mutex_take(consumer_producer_t* queue, char** out, int max_items){
+    int n = 0;
+    size_t bytes = atomic_load_explicit(&queue->bytes, memory_order_relaxed);
+    while (n < max_items && n < queue->count) {
+        out[n] = queue->items[queue->head];
+        ANALYZER_PROBE2(queue_get, queue, out[n]);
+        bytes -= item_bytes(queue, out[n++]);
+        queue->items[queue->head] = NULL;
+        queue->head  = (queue->head+1) % queue->capacity;
+    }
+    __atomic_store_n(&queue->count, queue->count - n, __ATOMIC_RELAXED);
+    atomic_store_explicit(&queue->bytes, bytes, memory_order_relaxed);
+    mutex_wake(&queue->not_full, &queue->full_waiters, n);
+    return n;
+}
+
+static int mutex_get_batch(consumer_producer_t* queue, char** out, int max_items){
+    pthread_mutex_lock(&queue->lock);
     while (1) {
-        pthread_mutex_lock(&queue->lock);
         if (queue->count > 0) {
-            char* itemToReturn = queue ->items[queue->head];
-            queue->items[queue->head] = NULL;
-            queue->head  = (queue->head+1) % queue->capacity;
-            queue->count--;
-            monitor_signal(&queue->not_full_monitor);
+            int n = mutex_take(queue, out, max_items);
             pthread_mutex_unlock(&queue->lock);
-            //2. pop item and return  
-            return itemToReturn;
+            return n;
         }
-        if(queue->is_finished && queue->count == 0){
+        if (atomic_load(&queue->is_finished)) {
             pthread_mutex_unlock(&queue->lock);
-            return NULL;
+            return 0;
         }
-        pthread_mutex_unlock(&queue->lock);
-        if (monitor_wait(&queue->not_empty_monitor) != 0) {
-            return NULL;
+        if (queue->spin_count > 0) {
+            pthread_mutex_unlock(&queue->lock);
+            mutex_spin(queue, false, 0);
+            pthread_mutex_lock(&queue->lock);
+            if (queue->count > 0 || atomic_load(&queue->is_finished)) {
+                continue;
+            }
+        }
+        atomic_fetch_add(&queue->empty_waiters, 1);
+        int rc = pthread_cond_wait(&queue->not_empty, &queue->lock);
+        atomic_fetch_sub(&queue->empty_waiters, 1);
+        if (rc != 0) {
+            pthread_mutex_unlock(&queue->lock);
+            return 0;
+        }
+    }
+}
+
+const char* consumer_producer_put(consumer_producer_t* queue, const char* item){
+    //copy outside the lock; the queue owns the copy from here on
+    char* newItem = copy_item(queue, item);
+    if(newItem == NULL){
+        return "Memory allocation failed for item";
+    }
+    return consumer_producer_put_owned(queue, newItem);
+}
+
+const char* consumer_producer_put_owned(consumer_producer_t* queue, char* newItem){
+    if(queue->backend != CP_BACKEND_MUTEX){
+        return lockfree_put_batch(queue, &newItem, 1);
+    }
+    return mutex_put_batch(queue, &newItem, 1);
+}
+
+char* consumer_producer_get(consumer_producer_t* queue){
+    char* item = NULL;
+    consumer_producer_get_batch(queue, &item, 1);
+    return item;
+}
+
+const char* consumer_producer_put_batch(consumer_producer_t* queue, const char* const* items, int count){
+    if(count <= 0){
+        return NULL;
+    }
+    char** newItems = dup_items(queue, items, count);
+    if(newItems == NULL){
+        return "Memory allocation failed for item";
+    }
+    const char* err;
+    if(queue->backend != CP_BACKEND_MUTEX){
+        err = lockfree_put_batch(queue, newItems, count);
+    }else{
+        err = mutex_put_batch(queue, newItems, count);
+    }
+    free(newItems);
+    return err;
+}
+
+//an item was taken: hand the parked producer its wakeup. the fence pairs with
+//the one in consumer_producer_park: either the producer's retry sees the
+//room we made, or we see it parked
+static void wake_parked(consumer_producer_t* queue){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&queue->parked, memory_order_relaxed) == NULL){
+        return;
+    }
+    void* arg = atomic_exchange(&queue->parked, NULL);
+    if(arg != NULL){
+        queue->parked_wake(arg);
+    }
+}
+
+void consumer_producer_park(consumer_producer_t* queue, void (*wake)(void*), void* arg){
+    queue->parked_wake = wake;
+    atomic_store(&queue->parked, arg);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+int consumer_producer_get_batch(consumer_producer_t* queue, char** out, int max_items){
+    if(max_items <= 0){
+        return 0;
+    }
+    int n = queue->backend != CP_BACKEND_MUTEX ? lockfree_get_batch(queue, out, max_items)
+                                                : mutex_get_batch(queue, out, max_items);
+    if(n > 0){
+        wake_parked(queue);
+    }
+    return n;
+}
+
+const char* consumer_producer_put_message(consumer_producer_t* queue, message_t* msg){
+    return consumer_producer_put_owned(queue, (char*)msg);
+}
+
+int consumer_producer_get_messages(consumer_producer_t* queue, message_t** out, int max_items){
+    char* items[max_items > 0 ? max_items : 1];
+    int count = consumer_producer_get_batch(queue, items, max_items);
+    for(int i = 0; i < count; i++){
+        out[i] = (message_t*)items[i];
+    }
+    return count;
+}
+
+int consumer_producer_try_put_message(consumer_producer_t* queue, message_t* msg){
+    char* item = (char*)msg;
+    size_t size = item_bytes(queue, item);
+    stamp_items(queue, &item, 1);
+    if(queue->backend != CP_BACKEND_MUTEX){
+        if(!lockfree_try_push(queue, item, size)){
+            return 0;
         }
-    }    
+        lockfree_wake(&queue->empty_waiters, &queue->not_empty_monitor);
+        return 1;
+    }
+    pthread_mutex_lock(&queue->lock);
+    size_t bytes = atomic_load_explicit(&queue->bytes, memory_order_relaxed);
+    if(!has_room(queue, queue->count, bytes, size)){
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+    ANALYZER_PROBE2(queue_put, queue, item);
+    queue->items[queue->tail] = item;
+    queue->tail = (queue->tail + 1) % queue->capacity;
+    __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_RELAXED);
+    atomic_store_explicit(&queue->bytes, bytes + size, memory_order_relaxed);
+    mutex_wake(&queue->not_empty, &queue->empty_waiters, 1);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+int consumer_producer_try_get_messages(consumer_producer_t* queue, message_t** out, int max_items){
+    if(max_items <= 0){
+        return 0;
+    }
+    char* items[max_items];
+    int count;
+    if(queue->backend != CP_BACKEND_MUTEX){
+        count = lockfree_take(queue, items, max_items);
+    }else{
+        pthread_mutex_lock(&queue->lock);
+        count = mutex_take(queue, items, max_items);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    if(count > 0){
+        wake_parked(queue);
+    }
+    for(int i = 0; i < count; i++){
+        out[i] = (message_t*)items[i];
+    }
+    return count;
+}
+
+int consumer_producer_count(consumer_producer_t* queue){
+    if(queue->backend != CP_BACKEND_MUTEX){
+        return (int)ring_size(queue);
+    }
+    return __atomic_load_n(&queue->count, __ATOMIC_RELAXED);
+}
+
+size_t consumer_producer_bytes(consumer_producer_t* queue){
+    return atomic_load_explicit(&queue->bytes, memory_order_relaxed);
 }
 
 void consumer_producer_signal_finished(consumer_producer_t* queue){
     pthread_mutex_lock(&queue->lock);
-    queue->is_finished= true;
+    atomic_store(&queue->is_finished, true);
+    //every parked consumer has to see the finished flag, not just one
+    pthread_cond_broadcast(&queue->not_empty);
     pthread_mutex_unlock(&queue->lock);
     monitor_signal(&queue->finished_monitor);
     monitor_signal(&queue->not_empty_monitor);
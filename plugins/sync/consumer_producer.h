@@ -1,5 +1,18 @@
 #include "monitor.h"
+#include "spsc_ring.h"
+#include "mpmc_ring.h"
+#include "message.h"
 #include <stdbool.h>
+#include <stdatomic.h>
+/**
+ * Storage backend of a consumer-producer queue, chosen per queue at init
+ */
+typedef enum
+{
+    CP_BACKEND_MUTEX = 0, /* Mutex-protected ring, any number of producers and consumers */
+    CP_BACKEND_SPSC, /* Lock-free ring, exactly one producer thread and one consumer thread */
+    CP_BACKEND_MPMC /* Lock-free ring, any number of producer and consumer threads */
+} consumer_producer_backend_t;
 /**
  * Consumer-Producer queue structure for thread-safe producer-consumer pattern
  * Now using monitors for simpler implementation
@@ -11,11 +24,27 @@ typedef struct
     int count; /* Current number of items */
     int head; /* Index of first item */
     int tail; /* Index of next insertion point */
-    monitor_t not_full_monitor; /* Monitor for "not full" state */
-    monitor_t not_empty_monitor; /* Monitor for "not empty" state */
+    monitor_t not_full_monitor; /* Monitor for "not full" state (lock-free backends) */
+    monitor_t not_empty_monitor; /* Monitor for "not empty" state (lock-free backends) */
     monitor_t finished_monitor; /* Monitor for finished signal */
-    bool is_finished;
-    pthread_mutex_t lock;
+    atomic_bool is_finished;
+    pthread_mutex_t lock; /* The one lock guarding the CP_BACKEND_MUTEX ring */
+    pthread_cond_t not_full; /* Producers wait here while full (CP_BACKEND_MUTEX only) */
+    pthread_cond_t not_empty; /* Consumers wait here while empty (CP_BACKEND_MUTEX only) */
+    consumer_producer_backend_t backend; /* Which storage backend is in use */
+    spsc_ring_t* ring; /* Lock-free ring (CP_BACKEND_SPSC only) */
+    mpmc_ring_t* mpmc; /* Lock-free ring (CP_BACKEND_MPMC only) */
+    atomic_int empty_waiters; /* Consumers currently parked waiting for an item */
+    atomic_int full_waiters; /* Producers currently parked waiting for a free slot */
+    int spin_count; /* Polls to try before parking (0 = park immediately) */
+    size_t max_bytes; /* Byte budget for queued payloads (0 = bounded by item count only) */
+    atomic_size_t bytes; /* Payload bytes currently queued, terminators included */
+    void* (*alloc_item)(size_t); /* Allocates the copies made by put (default malloc) */
+    void (*free_item)(void*); /* Frees items left behind at destroy (default free) */
+    bool messages; /* Items are message_t* instead of strings */
+    bool stamp; /* Messages get queued_at set as they go in (see consumer_producer_set_stamping) */
+    void (*parked_wake)(void*); /* Called for the parked producer once a get frees room */
+    _Atomic(void*) parked; /* Argument of the parked producer, NULL when none is parked */
 } consumer_producer_t;
 /**
  * Initialize a consumer-producer queue
@@ -24,6 +53,59 @@ typedef struct
  * @return NULL on success, error message on failure
  */
 const char* consumer_producer_init(consumer_producer_t* queue, int capacity);
+/**
+ * Initialize a consumer-producer queue with a specific storage backend
+ * CP_BACKEND_SPSC is only valid when a single thread puts and a single thread
+ * gets; it then never takes a lock unless the queue is empty or full.
+ * CP_BACKEND_MPMC allows any number of threads on both sides without a lock;
+ * use it for stages that several threads feed or drain.
+ * @param queue Pointer to queue structure
+ * @param capacity Maximum number of items
+ * @param backend Storage backend to use
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_init_backend(consumer_producer_t* queue, int capacity, consumer_producer_backend_t backend);
+/**
+ * Set how long a blocked put/get busy-waits before parking its thread.
+ * Spinning avoids a sleep/wake pair when the other side is running on another
+ * core and about to make progress; leave it at 0 on a single core.
+ * @param queue Pointer to queue structure
+ * @param spin_count Number of polls before parking (0 disables spinning)
+ */
+void consumer_producer_set_spin(consumer_producer_t* queue, int spin_count);
+/**
+ * Bound the queue by total payload bytes as well as by item count.
+ * A put blocks while the new item would push the queued bytes over the
+ * budget; an item larger than the whole budget is admitted once the queue is
+ * empty. Must be set before the queue is used.
+ * @param queue Pointer to queue structure
+ * @param max_bytes Byte budget (0 disables the byte bound)
+ */
+void consumer_producer_set_byte_budget(consumer_producer_t* queue, size_t max_bytes);
+/**
+ * Use a different allocator for queued items. put copies items with alloc,
+ * and destroy frees leftover items with free; consumers must release what get
+ * returns with the same free. Must be set before the queue is used.
+ * @param queue Pointer to queue structure
+ * @param alloc Allocation function (NULL keeps malloc)
+ * @param free_fn Matching free function (NULL keeps free)
+ */
+void consumer_producer_set_allocator(consumer_producer_t* queue, void* (*alloc)(size_t), void (*free_fn)(void*));
+/**
+ * Make the queue carry message_t* items (consumer_producer_put_message and
+ * consumer_producer_get_messages) instead of strings. Byte budgets then count
+ * message lengths, and destroy frees leftover messages with message_free and
+ * the queue's free function. Must be set before the queue is used.
+ * @param queue Pointer to queue structure
+ */
+void consumer_producer_set_messages(consumer_producer_t* queue);
+/**
+ * Set each message's queued_at (stage_stats_now) as it goes into the queue,
+ * so the consumer can tell how long it waited there. Message queues only;
+ * costs a clock read per put
+ * @param queue Pointer to queue structure (see consumer_producer_set_messages)
+ */
+void consumer_producer_set_stamping(consumer_producer_t* queue);
 /**
  * Destroy a consumer-producer queue and free its resources
  * @param queue Pointer to queue structure
@@ -38,6 +120,15 @@ void consumer_producer_destroy(consumer_producer_t* queue);
  */
 const char* consumer_producer_put(consumer_producer_t* queue, const char*
 item);
+/**
+ * Add an item to the queue without copying it (producer).
+ * Blocks if queue is full.
+ * @param queue Pointer to queue structure
+ * @param item String to add, allocated with the queue's allocator. The queue
+ * owns it from now on, also when an error is returned
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_owned(consumer_producer_t* queue, char* item);
 /**
  * Remove an item from the queue (consumer) and returns it.
  * Blocks if queue is empty.
@@ -45,6 +136,82 @@ item);
  * @return String item or NULL if queue is empty
  */
 char* consumer_producer_get(consumer_producer_t* queue);
+/**
+ * Add several items to the queue (producer).
+ * Moves as many items as fit per lock acquisition and wakes the consumer once
+ * per round instead of once per item. Blocks until all items are queued.
+ * @param queue Pointer to queue structure
+ * @param items Strings to add (queue stores its own copies)
+ * @param count Number of items
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_batch(consumer_producer_t* queue, const char* const* items, int count);
+/**
+ * Remove up to max_items items from the queue (consumer).
+ * Blocks until at least one item is available, then takes everything that is
+ * ready (up to max_items) with one lock acquisition and one wakeup.
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items (caller takes ownership)
+ * @param max_items Capacity of out
+ * @return Number of items stored in out, 0 if the queue is finished and empty
+ */
+int consumer_producer_get_batch(consumer_producer_t* queue, char** out, int max_items);
+/**
+ * Add a message to a message queue without copying it (producer).
+ * Blocks if queue is full.
+ * @param queue Pointer to queue structure (see consumer_producer_set_messages)
+ * @param msg Message to add. The queue owns it from now on, also when an
+ * error is returned
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_message(consumer_producer_t* queue, message_t* msg);
+/**
+ * Remove up to max_items messages from a message queue (consumer), like
+ * consumer_producer_get_batch
+ * @param queue Pointer to queue structure (see consumer_producer_set_messages)
+ * @param out Array receiving the messages (caller takes ownership)
+ * @param max_items Capacity of out
+ * @return Number of messages stored in out, 0 if the queue is finished and empty
+ */
+int consumer_producer_get_messages(consumer_producer_t* queue, message_t** out, int max_items);
+/**
+ * Add a message if there is room right now; never waits
+ * @param queue Pointer to queue structure (see consumer_producer_set_messages)
+ * @param msg Message to add. The queue owns it only when 1 is returned
+ * @return 1 if the message was queued, 0 if the queue is full
+ */
+int consumer_producer_try_put_message(consumer_producer_t* queue, message_t* msg);
+/**
+ * Park a producer that must not wait (a task on a thread pool) on a full
+ * queue: the next get that takes an item calls wake(arg) once, on the getting
+ * thread. Park first, then retry consumer_producer_try_put_message before
+ * giving up the thread, or a get in between goes unnoticed. One producer can
+ * be parked at a time; parking again replaces it
+ * @param queue Pointer to queue structure
+ * @param wake Called with arg when room frees up (must not block)
+ * @param arg Identifies the producer
+ */
+void consumer_producer_park(consumer_producer_t* queue, void (*wake)(void*), void* arg);
+/**
+ * Remove up to max_items messages that are queued right now; never waits
+ * @param queue Pointer to queue structure (see consumer_producer_set_messages)
+ * @param out Array receiving the messages (caller takes ownership)
+ * @param max_items Capacity of out
+ * @return Number of messages stored in out, 0 if the queue is empty
+ */
+int consumer_producer_try_get_messages(consumer_producer_t* queue, message_t** out, int max_items);
+/**
+ * Number of items currently queued (a snapshot while other threads run)
+ * @param queue Pointer to queue structure
+ * @return Item count
+ */
+int consumer_producer_count(consumer_producer_t* queue);
+/**
+ * Payload bytes currently queued (a snapshot while other threads run)
+ * @param queue Pointer to queue structure
+ * @return Byte count, terminators included
+ */
+size_t consumer_producer_bytes(consumer_producer_t* queue);
 /**
  * Signal that processing is finished
  * @param queue Pointer to queue structure
@@ -1,9 +1,11 @@
 #include "consumer_producer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/resource.h>
 #define TOTAL_ITEMS 20
 #define CONSUMER_COUNT 3
 #define QUEUE_CAPACITY 5
@@ -340,6 +342,449 @@ void run_test8_destroy_after_use() {
     printf("=== Test 8 Complete ===\n\n");
 }
 
+#define SPSC_TOTAL_ITEMS 1000
+void* producer_thread_test9(void* arg){
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    char buffer[64];
+    for (int i = 0; i < SPSC_TOTAL_ITEMS; i++) {
+        snprintf(buffer, sizeof(buffer), "ITEM_%d", i);
+        consumer_producer_put(queue, buffer);
+    }
+    consumer_producer_signal_finished(queue);
+    return NULL;
+}
+void* consumer_thread_test9(void* arg){
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    int expected = 0;
+    int ok = 1;
+    char* item;
+    while ((item = consumer_producer_get(queue)) != NULL) {
+        int n;
+        if (sscanf(item, "ITEM_%d", &n) != 1 || n != expected) {
+            printf("[Test 9] [FAIL] expected ITEM_%d, got %s\n", expected, item);
+            ok = 0;
+        }
+        expected++;
+        free(item);
+    }
+    if (ok && expected == SPSC_TOTAL_ITEMS) {
+        printf("[Test 9] [PASS] All %d items received in order.\n", SPSC_TOTAL_ITEMS);
+    } else {
+        printf("[Test 9] [FAIL] received %d of %d items\n", expected, SPSC_TOTAL_ITEMS);
+    }
+    return NULL;
+}
+void run_test9_spsc_backend_order() {
+    printf("=== Test 9 [CONSUMER-PRODUCER]: SPSC backend keeps order through a full ring ===\n");
+    consumer_producer_t copo;
+    // capacity 3 is rounded up to 4 slots but must still hold at most 3 items
+    consumer_producer_init_backend(&copo, 3, CP_BACKEND_SPSC);
+
+    pthread_t prod, cons;
+    pthread_create(&cons, NULL, consumer_thread_test9, &copo);
+    pthread_create(&prod, NULL, producer_thread_test9, &copo);
+
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    consumer_producer_destroy(&copo);
+    printf("=== Test 9 Complete ===\n\n");
+}
+
+#define BATCH_TOTAL_ITEMS 100
+#define BATCH_SIZE 7
+void* producer_thread_test10(void* arg){
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    char buffers[BATCH_SIZE][64];
+    const char* batch[BATCH_SIZE];
+    int next = 0;
+    while (next < BATCH_TOTAL_ITEMS) {
+        int n = 0;
+        while (n < BATCH_SIZE && next < BATCH_TOTAL_ITEMS) {
+            snprintf(buffers[n], sizeof(buffers[n]), "ITEM_%d", next++);
+            batch[n] = buffers[n];
+            n++;
+        }
+        consumer_producer_put_batch(queue, batch, n);
+    }
+    consumer_producer_signal_finished(queue);
+    return NULL;
+}
+void* consumer_thread_test10(void* arg){
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    char* batch[BATCH_SIZE];
+    int expected = 0;
+    int ok = 1;
+    int count;
+    while ((count = consumer_producer_get_batch(queue, batch, BATCH_SIZE)) > 0) {
+        for (int i = 0; i < count; i++) {
+            int n;
+            if (sscanf(batch[i], "ITEM_%d", &n) != 1 || n != expected) {
+                printf("[Test 10] [FAIL] expected ITEM_%d, got %s\n", expected, batch[i]);
+                ok = 0;
+            }
+            expected++;
+            free(batch[i]);
+        }
+    }
+    if (ok && expected == BATCH_TOTAL_ITEMS) {
+        printf("[Test 10] [PASS] All %d items received in order.\n", BATCH_TOTAL_ITEMS);
+    } else {
+        printf("[Test 10] [FAIL] received %d of %d items\n", expected, BATCH_TOTAL_ITEMS);
+    }
+    return NULL;
+}
+void run_test10_batch_put_get() {
+    printf("=== Test 10 [CONSUMER-PRODUCER]: batched put/get larger than capacity ===\n");
+    consumer_producer_backend_t backends[] = { CP_BACKEND_MUTEX, CP_BACKEND_SPSC };
+    for (int b = 0; b < 2; b++) {
+        consumer_producer_t copo;
+        consumer_producer_init_backend(&copo, 4, backends[b]);
+
+        pthread_t prod, cons;
+        pthread_create(&cons, NULL, consumer_thread_test10, &copo);
+        pthread_create(&prod, NULL, producer_thread_test10, &copo);
+
+        pthread_join(prod, NULL);
+        pthread_join(cons, NULL);
+
+        consumer_producer_destroy(&copo);
+    }
+    printf("=== Test 10 Complete ===\n\n");
+}
+
+#define THROUGHPUT_ITEMS 200000
+typedef struct {
+    consumer_producer_t* queue;
+    int items;
+} throughput_arg_t;
+void* throughput_producer(void* arg){
+    throughput_arg_t* args = (throughput_arg_t*)arg;
+    for (int i = 0; i < args->items; i++) {
+        consumer_producer_put(args->queue, "x");
+    }
+    return NULL;
+}
+void* throughput_consumer(void* arg){
+    throughput_arg_t* args = (throughput_arg_t*)arg;
+    for (int i = 0; i < args->items; i++) {
+        free(consumer_producer_get(args->queue));
+    }
+    return NULL;
+}
+// times the test 1 (1 producer) and test 6 (3 producers) shapes with many items
+void run_throughput(const char* label, consumer_producer_backend_t backend, int producers, int consumers, int capacity, int spin) {
+    consumer_producer_t copo;
+    consumer_producer_init_backend(&copo, capacity, backend);
+    consumer_producer_set_spin(&copo, spin);
+    throughput_arg_t prod_arg = { &copo, THROUGHPUT_ITEMS / producers };
+    throughput_arg_t cons_arg = { &copo, prod_arg.items * producers };
+
+    struct rusage ru_start, ru_end;
+    struct timespec start, end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t prod[3], cons[3];
+    throughput_arg_t per_cons_arg = { &copo, cons_arg.items / consumers };
+    for (int i = 0; i < consumers; i++) {
+        pthread_create(&cons[i], NULL, throughput_consumer, &per_cons_arg);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&prod[i], NULL, throughput_producer, &prod_arg);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(prod[i], NULL);
+    }
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(cons[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &ru_end);
+    consumer_producer_destroy(&copo);
+
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    long switches = (ru_end.ru_nvcsw - ru_start.ru_nvcsw) + (ru_end.ru_nivcsw - ru_start.ru_nivcsw);
+    printf("[Test 11] %-28s %8.1f ns/item %8ld context switches\n", label, elapsed / cons_arg.items, switches);
+}
+void run_test11_throughput() {
+    printf("=== Test 11 [CONSUMER-PRODUCER]: throughput (%d items) ===\n", THROUGHPUT_ITEMS);
+    run_throughput("mutex 1P/1C capacity 2", CP_BACKEND_MUTEX, 1, 1, 2, 0);
+    run_throughput("mutex 3P/1C capacity 5", CP_BACKEND_MUTEX, 3, 1, 5, 0);
+    run_throughput("mutex 3P/3C capacity 5", CP_BACKEND_MUTEX, 3, 3, 5, 0);
+    run_throughput("spsc 1P/1C capacity 2", CP_BACKEND_SPSC, 1, 1, 2, 0);
+    run_throughput("mpmc 3P/1C capacity 5", CP_BACKEND_MPMC, 3, 1, 5, 0);
+    run_throughput("mpmc 3P/3C capacity 5", CP_BACKEND_MPMC, 3, 3, 5, 0);
+    run_throughput("mutex 1P/1C capacity 2 spin", CP_BACKEND_MUTEX, 1, 1, 2, 200);
+    run_throughput("mutex 3P/1C capacity 5 spin", CP_BACKEND_MUTEX, 3, 1, 5, 200);
+    run_throughput("spsc 1P/1C capacity 2 spin", CP_BACKEND_SPSC, 1, 1, 2, 200);
+    run_throughput("mpmc 3P/3C capacity 5 spin", CP_BACKEND_MPMC, 3, 3, 5, 200);
+    printf("=== Test 11 Complete ===\n\n");
+}
+
+#define MPMC_PRODUCERS 3
+#define MPMC_CONSUMERS 3
+#define MPMC_ITEMS_PER_PRODUCER 1000
+int mpmc_seen[MPMC_PRODUCERS][MPMC_ITEMS_PER_PRODUCER];
+void* producer_thread_test12(void* arg) {
+    producer_arg_t* args = (producer_arg_t*)arg;
+    char buffer[64];
+    for (int i = 0; i < MPMC_ITEMS_PER_PRODUCER; i++) {
+        snprintf(buffer, sizeof(buffer), "%d:%d", args->producer_id, i);
+        consumer_producer_put(args->queue, buffer);
+    }
+    return NULL;
+}
+void* consumer_thread_test12(void* arg) {
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    int last[MPMC_PRODUCERS];
+    for (int p = 0; p < MPMC_PRODUCERS; p++) {
+        last[p] = -1;
+    }
+    char* item;
+    while ((item = consumer_producer_get(queue)) != NULL) {
+        int p, n;
+        if (sscanf(item, "%d:%d", &p, &n) == 2 && p >= 0 && p < MPMC_PRODUCERS && n >= 0 && n < MPMC_ITEMS_PER_PRODUCER) {
+            __atomic_fetch_add(&mpmc_seen[p][n], 1, __ATOMIC_RELAXED);
+            // items of one producer must reach any single consumer in order
+            if (n <= last[p]) {
+                printf("[Test 12] [FAIL] producer %d item %d after %d\n", p, n, last[p]);
+            }
+            last[p] = n;
+        }
+        free(item);
+    }
+    return NULL;
+}
+void run_test12_mpmc_backend() {
+    printf("=== Test 12 [CONSUMER-PRODUCER]: MPMC backend, multiple producers and consumers ===\n");
+    consumer_producer_t copo;
+    consumer_producer_init_backend(&copo, 4, CP_BACKEND_MPMC);
+
+    pthread_t producers[MPMC_PRODUCERS], consumers[MPMC_CONSUMERS];
+    producer_arg_t args[MPMC_PRODUCERS];
+    for (int i = 0; i < MPMC_CONSUMERS; i++) {
+        pthread_create(&consumers[i], NULL, consumer_thread_test12, &copo);
+    }
+    for (int i = 0; i < MPMC_PRODUCERS; i++) {
+        args[i].queue = &copo;
+        args[i].producer_id = i;
+        pthread_create(&producers[i], NULL, producer_thread_test12, &args[i]);
+    }
+    for (int i = 0; i < MPMC_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    consumer_producer_signal_finished(&copo);
+    for (int i = 0; i < MPMC_CONSUMERS; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    int ok = 1;
+    for (int p = 0; p < MPMC_PRODUCERS; p++) {
+        for (int n = 0; n < MPMC_ITEMS_PER_PRODUCER; n++) {
+            if (mpmc_seen[p][n] != 1) {
+                printf("[Test 12] [FAIL] item %d:%d seen %d times (expected once)\n", p, n, mpmc_seen[p][n]);
+                ok = 0;
+            }
+        }
+    }
+    if (ok) {
+        printf("[Test 12] [PASS] All %d items received exactly once.\n", MPMC_PRODUCERS * MPMC_ITEMS_PER_PRODUCER);
+    }
+    consumer_producer_destroy(&copo);
+    printf("=== Test 12 Complete ===\n\n");
+}
+
+void* consumer_thread_test13(void* arg){
+    usleep(200000);
+    free(consumer_producer_get((consumer_producer_t*)arg));
+    return NULL;
+}
+void run_test13_byte_budget() {
+    printf("=== Test 13 [CONSUMER-PRODUCER]: byte budget blocks before item capacity ===\n");
+    const char* names[] = { "mutex", "spsc", "mpmc" };
+    consumer_producer_backend_t backends[] = { CP_BACKEND_MUTEX, CP_BACKEND_SPSC, CP_BACKEND_MPMC };
+    for (int b = 0; b < 3; b++) {
+        consumer_producer_t copo;
+        consumer_producer_init_backend(&copo, 10, backends[b]);
+        consumer_producer_set_byte_budget(&copo, 8);
+        int ok = 1;
+
+        // two 4-byte items ("abc" + terminator) use up the whole budget
+        consumer_producer_put(&copo, "abc");
+        consumer_producer_put(&copo, "def");
+        if (consumer_producer_count(&copo) != 2 || consumer_producer_bytes(&copo) != 8) {
+            printf("[Test 13] [FAIL] %s: expected 2 items / 8 bytes, got %d / %zu\n", names[b],
+                   consumer_producer_count(&copo), consumer_producer_bytes(&copo));
+            ok = 0;
+        }
+
+        // the third put must wait for the consumer even though 8 slots are free
+        pthread_t cons;
+        struct timespec start, end;
+        pthread_create(&cons, NULL, consumer_thread_test13, &copo);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        consumer_producer_put(&copo, "ghi");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pthread_join(cons, NULL);
+        double waited = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (waited < 0.1) {
+            printf("[Test 13] [FAIL] %s: put over the budget did not block (%.2fs)\n", names[b], waited);
+            ok = 0;
+        }
+
+        // an item larger than the whole budget still fits into an empty queue
+        free(consumer_producer_get(&copo));
+        free(consumer_producer_get(&copo));
+        consumer_producer_put(&copo, "longer than eight bytes");
+        char* item = consumer_producer_get(&copo);
+        if (item == NULL || consumer_producer_bytes(&copo) != 0) {
+            printf("[Test 13] [FAIL] %s: oversized item was not admitted into an empty queue\n", names[b]);
+            ok = 0;
+        }
+        free(item);
+        if (ok) {
+            printf("[Test 13] [PASS] %s backend honours the byte budget.\n", names[b]);
+        }
+        consumer_producer_destroy(&copo);
+    }
+    printf("=== Test 13 Complete ===\n\n");
+}
+
+// test14 - message queues keep lengths (NULs included) and free leftovers at destroy
+void run_test14_message_queue() {
+    printf("=== Test 14 [CONSUMER-PRODUCER]: message items ===\n");
+    const char* names[] = { "mutex", "spsc", "mpmc" };
+    consumer_producer_backend_t backends[] = { CP_BACKEND_MUTEX, CP_BACKEND_SPSC, CP_BACKEND_MPMC };
+    for (int b = 0; b < 3; b++) {
+        consumer_producer_t copo;
+        consumer_producer_init_backend(&copo, 4, backends[b]);
+        consumer_producer_set_messages(&copo);
+        int ok = 1;
+
+        message_t* msg = message_new(malloc, 3);
+        memcpy(msg->data, "a\0b", 3);
+        msg->len = 3;
+        consumer_producer_put_message(&copo, msg);
+        consumer_producer_put_message(&copo, message_wrap(malloc, strdup("left over"), 9));
+        // payload plus terminator, like strings
+        if (consumer_producer_bytes(&copo) != 4 + 10) {
+            printf("[Test 14] [FAIL] %s: expected 14 queued bytes, got %zu\n", names[b], consumer_producer_bytes(&copo));
+            ok = 0;
+        }
+        message_t* out[1];
+        if (consumer_producer_get_messages(&copo, out, 1) != 1 || out[0]->len != 3 || memcmp(out[0]->data, "a\0b", 3) != 0) {
+            printf("[Test 14] [FAIL] %s: message came back changed\n", names[b]);
+            ok = 0;
+        } else {
+            message_free(out[0], free);
+        }
+        if (ok) {
+            printf("[Test 14] [PASS] %s backend carries messages.\n", names[b]);
+        }
+        // the wrapped message is still queued: destroy frees header and payload
+        consumer_producer_destroy(&copo);
+    }
+    printf("=== Test 14 Complete ===\n\n");
+}
+
+void run_test15_try_put_get() {
+    printf("=== Test 15 [CONSUMER-PRODUCER]: try put / try get never wait ===\n");
+    const char* names[] = { "mutex", "spsc", "mpmc" };
+    consumer_producer_backend_t backends[] = { CP_BACKEND_MUTEX, CP_BACKEND_SPSC, CP_BACKEND_MPMC };
+    for (int b = 0; b < 3; b++) {
+        consumer_producer_t copo;
+        consumer_producer_init_backend(&copo, 2, backends[b]);
+        consumer_producer_set_messages(&copo);
+        int ok = 1;
+
+        message_t* out[4];
+        if (consumer_producer_try_get_messages(&copo, out, 4) != 0) {
+            printf("[Test 15] [FAIL] %s: got an item from an empty queue\n", names[b]);
+            ok = 0;
+        }
+        int placed = 0;
+        message_t* extra = NULL;
+        for (int i = 0; i < 3; i++) {
+            message_t* msg = message_wrap(malloc, strdup("x"), 1);
+            if (consumer_producer_try_put_message(&copo, msg)) {
+                placed++;
+            } else {
+                extra = msg;
+            }
+        }
+        // a full queue hands the message back instead of waiting
+        if (placed != 2 || extra == NULL) {
+            printf("[Test 15] [FAIL] %s: expected 2 of 3 placed, got %d\n", names[b], placed);
+            ok = 0;
+        }
+        message_free(extra, free);
+        int got = consumer_producer_try_get_messages(&copo, out, 4);
+        for (int i = 0; i < got; i++) {
+            message_free(out[i], free);
+        }
+        if (got != 2) {
+            printf("[Test 15] [FAIL] %s: expected 2 items back, got %d\n", names[b], got);
+            ok = 0;
+        }
+        if (ok) {
+            printf("[Test 15] [PASS] %s backend try put/get.\n", names[b]);
+        }
+        consumer_producer_destroy(&copo);
+    }
+    printf("=== Test 15 Complete ===\n\n");
+}
+
+static int parked_wakes;
+
+static void count_wake(void* arg) {
+    (*(int*)arg)++;
+}
+
+void run_test16_park_producer() {
+    printf("=== Test 16 [CONSUMER-PRODUCER]: parked producer is woken once by a get ===\n");
+    const char* names[] = { "mutex", "spsc", "mpmc" };
+    consumer_producer_backend_t backends[] = { CP_BACKEND_MUTEX, CP_BACKEND_SPSC, CP_BACKEND_MPMC };
+    for (int b = 0; b < 3; b++) {
+        consumer_producer_t copo;
+        consumer_producer_init_backend(&copo, 2, backends[b]);
+        consumer_producer_set_messages(&copo);
+        int ok = 1;
+        parked_wakes = 0;
+
+        consumer_producer_try_put_message(&copo, message_wrap(malloc, strdup("a"), 1));
+        consumer_producer_try_put_message(&copo, message_wrap(malloc, strdup("b"), 1));
+        message_t* extra = message_wrap(malloc, strdup("c"), 1);
+        consumer_producer_park(&copo, count_wake, &parked_wakes);
+        // still full after parking: the producer gives up its thread
+        if (consumer_producer_try_put_message(&copo, extra) || parked_wakes != 0) {
+            printf("[Test 16] [FAIL] %s: full queue took the item or woke early\n", names[b]);
+            ok = 0;
+        }
+        message_t* out[2];
+        int got = consumer_producer_try_get_messages(&copo, out, 1);
+        got += consumer_producer_get_messages(&copo, out + 1, 1);
+        for (int i = 0; i < got; i++) {
+            message_free(out[i], free);
+        }
+        if (got != 2 || parked_wakes != 1) {
+            printf("[Test 16] [FAIL] %s: expected one wake after two gets, got %d\n", names[b], parked_wakes);
+            ok = 0;
+        }
+        if (!consumer_producer_try_put_message(&copo, extra)) {
+            printf("[Test 16] [FAIL] %s: woken producer found no room\n", names[b]);
+            message_free(extra, free);
+            ok = 0;
+        }
+        if (ok) {
+            printf("[Test 16] [PASS] %s backend wakes a parked producer once.\n", names[b]);
+        }
+        consumer_producer_destroy(&copo);
+    }
+    printf("=== Test 16 Complete ===\n\n");
+}
+
 int main(){
     run_test1_single_producer_single_consumer();
     run_test2_get_before_put();
@@ -349,5 +794,13 @@ int main(){
     run_test6_multiple_producers_one_consumer();
     //run_test7_multiple_consumers_one_producer();
     run_test8_destroy_after_use();
+    run_test9_spsc_backend_order();
+    run_test10_batch_put_get();
+    run_test11_throughput();
+    run_test12_mpmc_backend();
+    run_test13_byte_budget();
+    run_test14_message_queue();
+    run_test15_try_put_get();
+    run_test16_park_producer();
     return 0;
 }
\ No newline at end of file
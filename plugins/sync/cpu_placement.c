@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include "cpu_placement.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Topology of one CPU, for ordering the automatic placement
+ */
+typedef struct
+{
+    int cpu;
+    int package; /* Socket */
+    int core; /* Core within the socket; hyperthread siblings share it */
+} cpu_topology_t;
+
+//read one number from /sys/devices/system/cpu/cpuN/topology, fallback if missing
+static int read_topology(int cpu, const char* field, int fallback){
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, field);
+    FILE* file = fopen(path, "r");
+    if(file == NULL){
+        return fallback;
+    }
+    int value;
+    if(fscanf(file, "%d", &value) != 1){
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+static int compare_topology(const void* a, const void* b){
+    const cpu_topology_t* x = a;
+    const cpu_topology_t* y = b;
+    if(x->package != y->package){
+        return x->package - y->package;
+    }
+    if(x->core != y->core){
+        return x->core - y->core;
+    }
+    return x->cpu - y->cpu;
+}
+
+//every allowed CPU, siblings adjacent, one package after the other
+static const char* placement_auto(cpu_placement_t* placement){
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        return "Cannot read the process CPU set";
+    }
+    int count = CPU_COUNT(&allowed);
+    cpu_topology_t* topology = calloc(count, sizeof(cpu_topology_t));
+    placement->cpus = calloc(count, sizeof(int));
+    if(topology == NULL || placement->cpus == NULL){
+        free(topology);
+        free(placement->cpus);
+        placement->cpus = NULL;
+        return "Memory allocation failed";
+    }
+    int n = 0;
+    for(int cpu = 0; cpu < CPU_SETSIZE && n < count; cpu++){
+        if(CPU_ISSET(cpu, &allowed)){
+            topology[n].cpu = cpu;
+            topology[n].package = read_topology(cpu, "physical_package_id", 0);
+            topology[n].core = read_topology(cpu, "core_id", cpu);
+            n++;
+        }
+    }
+    qsort(topology, n, sizeof(cpu_topology_t), compare_topology);
+    for(int i = 0; i < n; i++){
+        placement->cpus[i] = topology[i].cpu;
+    }
+    placement->count = n;
+    free(topology);
+    return NULL;
+}
+
+//"0,2,4-7": CPUs in the order given
+static const char* placement_list(cpu_placement_t* placement, const char* spec){
+    int cap = 16;
+    placement->cpus = malloc(cap * sizeof(int));
+    if(placement->cpus == NULL){
+        return "Memory allocation failed";
+    }
+    const char* p = spec;
+    while(*p != '\0'){
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if(end == p || first < 0 || first >= CPU_SETSIZE){
+            return "CPU list is not valid";
+        }
+        p = end;
+        if(*p == '-'){
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first || last >= CPU_SETSIZE){
+                return "CPU list is not valid";
+            }
+            p = end;
+        }
+        for(long cpu = first; cpu <= last; cpu++){
+            if(placement->count == cap){
+                cap *= 2;
+                int* grown = realloc(placement->cpus, cap * sizeof(int));
+                if(grown == NULL){
+                    return "Memory allocation failed";
+                }
+                placement->cpus = grown;
+            }
+            placement->cpus[placement->count++] = (int)cpu;
+        }
+        if(*p == ','){
+            p++;
+            if(*p == '\0'){
+                return "CPU list is not valid";
+            }
+        }else if(*p != '\0'){
+            return "CPU list is not valid";
+        }
+    }
+    //a thread pinned outside the process CPU set would fail to start
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0){
+        for(int i = 0; i < placement->count; i++){
+            if(!CPU_ISSET(placement->cpus[i], &allowed)){
+                return "CPU list names a CPU this process cannot use";
+            }
+        }
+    }
+    return placement->count > 0 ? NULL : "CPU list is not valid";
+}
+
+const char* cpu_placement_init(cpu_placement_t* placement, const char* spec){
+    placement->cpus = NULL;
+    placement->count = 0;
+    atomic_init(&placement->next, 0);
+    const char* err = strcmp(spec, "auto") == 0 ? placement_auto(placement) : placement_list(placement, spec);
+    if(err != NULL){
+        cpu_placement_destroy(placement);
+    }
+    return err;
+}
+
+void cpu_placement_destroy(cpu_placement_t* placement){
+    free(placement->cpus);
+    placement->cpus = NULL;
+    placement->count = 0;
+}
+
+int cpu_placement_next(cpu_placement_t* placement){
+    if(placement->count == 0){
+        return -1;
+    }
+    int index = atomic_fetch_add(&placement->next, 1);
+    return placement->cpus[index % placement->count];
+}
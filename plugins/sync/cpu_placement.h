@@ -0,0 +1,34 @@
+#include <stdatomic.h>
+/**
+ * Where pipeline threads run: an ordered list of CPUs handed out one per
+ * thread in start order (main reader first, then each stage thread in stage
+ * order), wrapping around when there are more threads than CPUs
+ */
+typedef struct
+{
+    int* cpus; /* CPUs in hand-out order */
+    int count; /* Entries in cpus */
+    atomic_int next; /* Index of the next CPU to hand out */
+} cpu_placement_t;
+/**
+ * Build a placement from a specification
+ *  - "auto": every CPU the process may use, hyperthread siblings next to each
+ *    other and cores of one package together, so adjacent pipeline stages
+ *    share a core (or at least a socket) and their handoffs stay in cache
+ *  - a list such as "0,2,4-7": exactly these CPUs, in this order
+ * @param placement Pointer to placement structure
+ * @param spec Specification
+ * @return NULL on success, error message on failure
+ */
+const char* cpu_placement_init(cpu_placement_t* placement, const char* spec);
+/**
+ * Release a placement
+ * @param placement Pointer to placement structure
+ */
+void cpu_placement_destroy(cpu_placement_t* placement);
+/**
+ * Take the CPU for the next thread (thread-safe)
+ * @param placement Pointer to placement structure
+ * @return CPU number, or -1 when the placement is empty
+ */
+int cpu_placement_next(cpu_placement_t* placement);
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "cpu_placement.h"
+
+// test1 - CPU lists keep their order and expand ranges; bad lists are rejected
+void run_test1_lists() {
+    printf("=== Test 1: CPU lists ===\n");
+    //the first CPU this process may use
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed)) {
+        cpu++;
+    }
+    char spec[16];
+    snprintf(spec, sizeof(spec), "%d", cpu);
+    cpu_placement_t placement;
+    const char* err = cpu_placement_init(&placement, spec);
+    printf("[Test 1] %s\n", err == NULL && placement.count == 1 && placement.cpus[0] == cpu ? "PASS: single CPU" : "FAIL: single CPU");
+    int first = cpu_placement_next(&placement);
+    int second = cpu_placement_next(&placement);
+    printf("[Test 1] %s\n", first == cpu && second == cpu ? "PASS: hand-out wraps around" : "FAIL: hand-out does not wrap");
+    cpu_placement_destroy(&placement);
+    const char* bad[] = { "", "1-0", "0,", "a", "0;1", "-1", "99999" };
+    int rejected = 0;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (cpu_placement_init(&placement, bad[i]) != NULL) {
+            rejected++;
+        } else {
+            printf("[Test 1] accepted '%s'\n", bad[i]);
+            cpu_placement_destroy(&placement);
+        }
+    }
+    printf("[Test 1] %s\n", rejected == (int)(sizeof(bad) / sizeof(bad[0])) ? "PASS: malformed lists rejected" : "FAIL: malformed list accepted");
+    printf("=== Test 1 Complete ===\n\n");
+}
+
+// test2 - ranges expand in order (only checked on machines with 2+ CPUs)
+void run_test2_ranges() {
+    printf("=== Test 2: Ranges ===\n");
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (!CPU_ISSET(0, &allowed) || !CPU_ISSET(1, &allowed)) {
+        printf("[Test 2] skipped: CPUs 0 and 1 not both available\n");
+        printf("=== Test 2 Complete ===\n\n");
+        return;
+    }
+    cpu_placement_t placement;
+    const char* err = cpu_placement_init(&placement, "1,0-1");
+    int ok = err == NULL && placement.count == 3 && placement.cpus[0] == 1 && placement.cpus[1] == 0 && placement.cpus[2] == 1;
+    printf("[Test 2] %s\n", ok ? "PASS: 1,0-1 -> 1 0 1" : "FAIL: range expansion");
+    cpu_placement_destroy(&placement);
+    printf("=== Test 2 Complete ===\n\n");
+}
+
+// test3 - auto covers exactly the CPUs the process may use
+void run_test3_auto() {
+    printf("=== Test 3: Automatic placement ===\n");
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    cpu_placement_t placement;
+    const char* err = cpu_placement_init(&placement, "auto");
+    int ok = err == NULL && placement.count == CPU_COUNT(&allowed);
+    cpu_set_t seen;
+    CPU_ZERO(&seen);
+    for (int i = 0; ok && i < placement.count; i++) {
+        ok = CPU_ISSET(placement.cpus[i], &allowed) && !CPU_ISSET(placement.cpus[i], &seen);
+        CPU_SET(placement.cpus[i], &seen);
+    }
+    printf("[Test 3] %s (%d CPUs)\n", ok ? "PASS: every allowed CPU once" : "FAIL: auto placement", placement.count);
+    cpu_placement_destroy(&placement);
+    printf("=== Test 3 Complete ===\n\n");
+}
+
+int main() {
+    run_test1_lists();
+    run_test2_ranges();
+    run_test3_auto();
+    return 0;
+}
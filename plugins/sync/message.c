@@ -0,0 +1,64 @@
+#include "message.h"
+#include <string.h>
+
+//payload lives right behind the header when the message was made by message_new
+static inline int is_inline(const message_t* msg){
+    return msg->data == (const char*)(msg + 1);
+}
+
+message_t* message_new(void* (*alloc)(size_t), size_t cap){
+    message_t* msg = alloc(sizeof(message_t) + cap + 1);
+    if(msg == NULL){
+        return NULL;
+    }
+    msg->data = (char*)(msg + 1);
+    msg->len = 0;
+    msg->cap = cap;
+    msg->kind = MESSAGE_DATA;
+    msg->queued_at = 0;
+    msg->data[0] = '\0';
+    return msg;
+}
+
+message_t* message_control(void* (*alloc)(size_t), message_kind_t kind){
+    message_t* msg = message_new(alloc, 0);
+    if(msg != NULL){
+        msg->kind = kind;
+    }
+    return msg;
+}
+
+message_t* message_wrap(void* (*alloc)(size_t), char* data, size_t len){
+    message_t* msg = alloc(sizeof(message_t));
+    if(msg == NULL){
+        return NULL;
+    }
+    msg->data = data;
+    msg->len = len;
+    msg->cap = len;
+    msg->kind = MESSAGE_DATA;
+    msg->queued_at = 0;
+    return msg;
+}
+
+char* message_detach(message_t* msg, void* (*alloc)(size_t), void (*free_fn)(void*)){
+    char* data = msg->data;
+    if(is_inline(msg)){
+        data = alloc(msg->len + 1);
+        if(data != NULL){
+            memcpy(data, msg->data, msg->len + 1);
+        }
+    }
+    free_fn(msg);
+    return data;
+}
+
+void message_free(message_t* msg, void (*free_fn)(void*)){
+    if(msg == NULL){
+        return;
+    }
+    if(!is_inline(msg)){
+        free_fn(msg->data);
+    }
+    free_fn(msg);
+}
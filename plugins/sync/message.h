@@ -0,0 +1,65 @@
+#include <stddef.h>
+#include <stdint.h>
+/**
+ * What a message carries. Control messages travel in stream order with the
+ * data but are never passed to a transform
+ */
+typedef enum
+{
+    MESSAGE_DATA = 0, /* A line of input (or what the stages made of it) */
+    MESSAGE_END, /* End of stream: stages forward it, then finish */
+    MESSAGE_FLUSH, /* Push out anything buffered */
+    MESSAGE_STATS /* Dump statistics */
+} message_kind_t;
+/**
+ * Length-carrying message: what travels through the queues and between
+ * stages. The payload may contain NUL bytes; data[len] is always a NUL so
+ * string code can still read a message that has none.
+ */
+typedef struct
+{
+    char* data; /* Payload */
+    size_t len; /* Payload bytes */
+    size_t cap; /* Bytes data can hold, not counting the terminator */
+    message_kind_t kind; /* Data or control */
+    uint64_t queued_at; /* When it entered its current queue (stage_stats_now), 0 unless the queue stamps */
+} message_t;
+/**
+ * Allocate an empty message with room for cap payload bytes, stored in the
+ * same block as the header
+ * @param alloc Allocation function
+ * @param cap Payload capacity
+ * @return The message (len 0), or NULL on failure
+ */
+message_t* message_new(void* (*alloc)(size_t), size_t cap);
+/**
+ * Allocate a control message (empty payload)
+ * @param alloc Allocation function
+ * @param kind Control kind (not MESSAGE_DATA)
+ * @return The message, or NULL on failure
+ */
+message_t* message_control(void* (*alloc)(size_t), message_kind_t kind);
+/**
+ * Wrap an existing NUL-terminated buffer in a message without copying it
+ * @param alloc Allocation function for the header
+ * @param data Buffer (the message owns it on success)
+ * @param len Payload bytes in data
+ * @return The message, or NULL on failure (data is left to the caller)
+ */
+message_t* message_wrap(void* (*alloc)(size_t), char* data, size_t len);
+/**
+ * Turn a message into a plain NUL-terminated buffer owned by the caller,
+ * releasing the header. Copies only when the payload shares the header's block
+ * @param msg Message (invalid afterwards)
+ * @param alloc Allocation function
+ * @param free_fn Free function matching alloc
+ * @return The buffer, or NULL on failure (msg is freed either way)
+ */
+char* message_detach(message_t* msg, void* (*alloc)(size_t), void (*free_fn)(void*));
+/**
+ * Free a message and its payload
+ * @param msg Message (NULL is ignored)
+ * @param free_fn Free function matching the allocator it came from
+ */
+void message_free(message_t* msg, void (*free_fn)(void*));
+
@@ -1,6 +1,93 @@
 #include <pthread.h>
 #include "monitor.h"
+#include "probes.h"
 #include <stdio.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MONITOR_SIGNALED 1u
+#define MONITOR_WAITER 2u
+
+static long futex(atomic_uint* word, int op, unsigned int value){
+    return syscall(SYS_futex, (unsigned int*)word, op, value, NULL, NULL, 0);
+}
+
+int monitor_init(monitor_t* monitor){
+    atomic_init(&monitor->state, 0);
+    return 0;
+}
+
+void monitor_destroy(monitor_t* monitor){
+    //nothing is allocated; a futex word needs no cleanup
+    if(atomic_load(&monitor->state) >= MONITOR_WAITER){
+        fprintf(stderr, "[ERROR] Destroying a monitor that still has waiters\n");
+    }
+}
+
+void monitor_signal(monitor_t* monitor){
+    //1. set the signaled bit (one atomic op when nobody waits)
+    //2. if a waiter is parked, wake one of them
+    unsigned int old = atomic_fetch_or(&monitor->state, MONITOR_SIGNALED);
+    if(old >= MONITOR_WAITER){
+        ANALYZER_PROBE1(monitor_signal, monitor);
+        if(futex(&monitor->state, FUTEX_WAKE_PRIVATE, 1) < 0){
+            fprintf(stderr, "[ERROR] Failed to wake monitor waiter\n");
+        }
+    }
+}
+
+void monitor_reset(monitor_t* monitor){
+    atomic_fetch_and(&monitor->state, ~MONITOR_SIGNALED);
+}
+
+//undo our waiter registration if the thread is cancelled while parked
+static void monitor_wait_cleanup(void* arg){
+    atomic_fetch_sub((atomic_uint*)arg, MONITOR_WAITER);
+}
+
+int monitor_wait(monitor_t* monitor){
+    unsigned int state = atomic_load(&monitor->state);
+    while(1){
+        //1. consume a pending signal
+        if(state & MONITOR_SIGNALED){
+            if(atomic_compare_exchange_weak(&monitor->state, &state, state & ~MONITOR_SIGNALED)){
+                return 0;
+            }
+            continue;
+        }
+        //2. register as a waiter; the signaler will see it and FUTEX_WAKE us
+        if(!atomic_compare_exchange_weak(&monitor->state, &state, state + MONITOR_WAITER)){
+            continue;
+        }
+        state += MONITOR_WAITER;
+        //3. sleep only while the word is unchanged (no signal since we looked).
+        //a raw futex syscall is not a cancellation point, so allow asynchronous
+        //cancellation just around it, the way pthread_cond_wait would behave
+        int old_type;
+        long rc;
+        //USDT: monitor_block(monitor) as the thread parks, monitor_wake(monitor)
+        //once it runs again; monitor_signal(monitor) when a parked one is woken
+        ANALYZER_PROBE1(monitor_block, monitor);
+        pthread_cleanup_push(monitor_wait_cleanup, &monitor->state);
+        pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &old_type);
+        rc = futex(&monitor->state, FUTEX_WAIT_PRIVATE, state);
+        pthread_setcanceltype(old_type, NULL);
+        pthread_cleanup_pop(0);
+        ANALYZER_PROBE1(monitor_wake, monitor);
+        if(rc < 0 && errno != EAGAIN && errno != EINTR){
+            atomic_fetch_sub(&monitor->state, MONITOR_WAITER);
+            fprintf(stderr, "[ERROR] Failed to wait on monitor futex\n");
+            return -1;
+        }
+        state = atomic_fetch_sub(&monitor->state, MONITOR_WAITER) - MONITOR_WAITER;
+    }
+}
+
+#else
 int monitor_init(monitor_t* monitor){
     if(pthread_mutex_init(&monitor->mutex,NULL)!=0){
         return -1;
@@ -38,6 +125,7 @@ void monitor_signal(monitor_t* monitor){
         return;
     }
     monitor->signaled = 1;
+    ANALYZER_PROBE1(monitor_signal, monitor);
     if(pthread_cond_signal(&monitor->condition) != 0){
         fprintf(stderr, "[ERROR] Failed to signal condition variable\n");
     }
@@ -65,7 +153,10 @@ int monitor_wait(monitor_t* monitor){
         return -1;
     }
     while(monitor->signaled == 0){
-        if(pthread_cond_wait(&monitor->condition,&monitor->mutex) != 0){
+        ANALYZER_PROBE1(monitor_block, monitor);
+        int rc = pthread_cond_wait(&monitor->condition,&monitor->mutex);
+        ANALYZER_PROBE1(monitor_wake, monitor);
+        if(rc != 0){
             fprintf(stderr, "[ERROR] Failed to wait on condition variable\n");
             pthread_mutex_unlock(&monitor->mutex);
             return -1;
@@ -77,4 +168,5 @@ int monitor_wait(monitor_t* monitor){
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,14 +1,30 @@
 #include <pthread.h>
+#ifdef __linux__
+#include <stdatomic.h>
+#endif
 /**
  * Monitor structure that can remember its state
  * This solves the race condition where signals sent before waiting are lost
  */
+#ifdef __linux__
+/*
+ * On Linux the whole monitor is one futex word: bit 0 is the signaled flag and
+ * the remaining bits count parked waiters. An uncontended signal or wait is a
+ * single atomic operation; the kernel is only entered when a waiter must sleep
+ * or a sleeping waiter must be woken.
+ */
+typedef struct
+{
+ atomic_uint state; /* MONITOR_SIGNALED flag | waiters * MONITOR_WAITER */
+} monitor_t;
+#else
 typedef struct
 {
  pthread_mutex_t mutex; /* Mutex for thread safety */
  pthread_cond_t condition; /* Condition variable */
  int signaled; /* Flag to remember if monitor was signaled */
 } monitor_t;
+#endif
 /**
  * Initialize a monitor
  * @param monitor Pointer to monitor structure
@@ -35,4 +51,4 @@ void monitor_reset(monitor_t* monitor);
  * @param monitor Pointer to monitor structure
  * @return 0 on success, -1 on error
  */
-int monitor_wait(monitor_t* monitor);
\ No newline at end of file
+int monitor_wait(monitor_t* monitor);
@@ -0,0 +1,88 @@
+#include "mpmc_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int mpmc_ring_init(mpmc_ring_t* ring, int capacity){
+    if(capacity <= 0){
+        return -1;
+    }
+    ring->slots = calloc(capacity, sizeof(mpmc_slot_t));
+    if(ring->slots == NULL){
+        fprintf(stderr, "[ERROR] Failed to allocate ring slots\n");
+        return -1;
+    }
+    ring->capacity = (size_t)capacity;
+    //slot i is first free for the producer that claims position i
+    for(size_t i = 0; i < ring->capacity; i++){
+        atomic_init(&ring->slots[i].seq, i);
+    }
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    return 0;
+}
+
+void mpmc_ring_destroy(mpmc_ring_t* ring){
+    size_t head = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for(size_t pos = head; pos != tail; pos++){
+        free(ring->slots[pos % ring->capacity].item);
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int mpmc_ring_try_push(mpmc_ring_t* ring, char* item){
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    while(1){
+        mpmc_slot_t* slot = &ring->slots[pos % ring->capacity];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long diff = (long)(seq - pos);
+        if(diff == 0){
+            //slot is free for position pos: claim it
+            if(atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed)){
+                slot->item = item;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        }else if(diff < 0){
+            //the consumer a full lap behind has not freed this slot yet
+            return 0;
+        }else{
+            //another producer took pos; retry from the current position
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+char* mpmc_ring_try_pop(mpmc_ring_t* ring){
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    while(1){
+        mpmc_slot_t* slot = &ring->slots[pos % ring->capacity];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long diff = (long)(seq - (pos + 1));
+        if(diff == 0){
+            //slot holds the item for position pos: claim it
+            if(atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed)){
+                char* item = slot->item;
+                slot->item = NULL;
+                //free the slot for the producer one lap ahead
+                atomic_store_explicit(&slot->seq, pos + ring->capacity, memory_order_release);
+                return item;
+            }
+        }else if(diff < 0){
+            //nothing published at pos yet
+            return NULL;
+        }else{
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+size_t mpmc_ring_size(mpmc_ring_t* ring){
+    //read the consumer side first so the difference never goes negative
+    size_t head = atomic_load_explicit(&ring->dequeue_pos, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->enqueue_pos, memory_order_acquire);
+    return tail - head;
+}
@@ -0,0 +1,56 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#define MPMC_CACHE_LINE 64
+/**
+ * One slot of an MPMC ring. seq tells producers and consumers whose turn it is:
+ * seq == pos means free for the producer at pos, seq == pos + 1 means it holds
+ * the item for the consumer at pos
+ */
+typedef struct
+{
+    atomic_size_t seq; /* Turn counter of this slot */
+    char* item; /* Stored string pointer */
+} mpmc_slot_t;
+/**
+ * Bounded lock-free multi-producer/multi-consumer ring (Vyukov-style)
+ * Producers and consumers each claim a position with one CAS on their own
+ * cache line, then hand the slot over through its sequence number
+ */
+typedef struct
+{
+    mpmc_slot_t* slots; /* Array of capacity slots */
+    size_t capacity; /* Maximum number of items */
+    _Alignas(MPMC_CACHE_LINE) atomic_size_t enqueue_pos; /* Next position to write (producers) */
+    _Alignas(MPMC_CACHE_LINE) atomic_size_t dequeue_pos; /* Next position to read (consumers) */
+} mpmc_ring_t;
+/**
+ * Initialize a ring that holds at most capacity items
+ * @param ring Pointer to ring structure (must be MPMC_CACHE_LINE aligned)
+ * @param capacity Maximum number of items
+ * @return 0 on success, -1 on failure
+ */
+int mpmc_ring_init(mpmc_ring_t* ring, int capacity);
+/**
+ * Destroy a ring, freeing any items still inside it
+ * @param ring Pointer to ring structure
+ */
+void mpmc_ring_destroy(mpmc_ring_t* ring);
+/**
+ * Push an item without blocking (any thread)
+ * @param ring Pointer to ring structure
+ * @param item Item to push (ring takes ownership on success)
+ * @return 1 if the item was pushed, 0 if the ring is full
+ */
+int mpmc_ring_try_push(mpmc_ring_t* ring, char* item);
+/**
+ * Pop an item without blocking (any thread)
+ * @param ring Pointer to ring structure
+ * @return The item, or NULL if the ring is empty
+ */
+char* mpmc_ring_try_pop(mpmc_ring_t* ring);
+/**
+ * Number of claimed positions in the ring (approximate while threads run)
+ * @param ring Pointer to ring structure
+ * @return Item count
+ */
+size_t mpmc_ring_size(mpmc_ring_t* ring);
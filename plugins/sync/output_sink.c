@@ -0,0 +1,127 @@
+#include "output_sink.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//most pieces one flush hands to writev: the buffer plus one record
+#define OUTPUT_SINK_MAX_PARTS 16
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+//writev until every byte is out; a short write resumes where it stopped
+static int write_all(int fd, struct iovec* parts, int count){
+    while(count > 0){
+        ssize_t n = writev(fd, parts, count);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno;
+        }
+        size_t done = (size_t)n;
+        while(count > 0 && done >= parts[0].iov_len){
+            done -= parts[0].iov_len;
+            parts++;
+            count--;
+        }
+        if(count > 0){
+            parts[0].iov_base = (char*)parts[0].iov_base + done;
+            parts[0].iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+//write the buffer and then the given record in one go; caller holds the lock
+static const char* write_out(output_sink_t* sink, const struct iovec* record, int count){
+    struct iovec parts[OUTPUT_SINK_MAX_PARTS];
+    int n = 0;
+    if(sink->len > 0){
+        parts[n].iov_base = sink->buffer;
+        parts[n].iov_len = sink->len;
+        n++;
+    }
+    for(int i = 0; i < count; i++){
+        parts[n++] = record[i];
+    }
+    sink->len = 0;
+    sink->oldest = 0;
+    int rc = n > 0 ? write_all(sink->fd, parts, n) : 0;
+    if(rc != 0){
+        if(sink->error == 0){
+            sink->error = rc;
+        }
+        return "Failed to write output";
+    }
+    return NULL;
+}
+
+const char* output_sink_init(output_sink_t* sink, int fd, size_t buffer_bytes, uint64_t flush_ns){
+    memset(sink, 0, sizeof(output_sink_t));
+    if(buffer_bytes > 0){
+        sink->buffer = malloc(buffer_bytes);
+        if(sink->buffer == NULL){
+            return "Memory allocation failed";
+        }
+    }
+    sink->fd = fd;
+    sink->cap = buffer_bytes;
+    sink->flush_ns = flush_ns;
+    pthread_mutex_init(&sink->lock, NULL);
+    return NULL;
+}
+
+const char* output_sink_write(output_sink_t* sink, const struct iovec* parts, int count){
+    if(count <= 0){
+        return NULL;
+    }
+    if(count > OUTPUT_SINK_MAX_PARTS - 1){
+        return "Too many parts in one record";
+    }
+    size_t size = 0;
+    for(int i = 0; i < count; i++){
+        size += parts[i].iov_len;
+    }
+    const char* err = NULL;
+    pthread_mutex_lock(&sink->lock);
+    if(sink->cap == 0 || sink->len + size > sink->cap){
+        //does not fit: out with the buffer, and this record right behind it
+        //without copying it (it may well be bigger than the buffer)
+        err = write_out(sink, parts, count);
+    }else{
+        uint64_t now = sink->flush_ns > 0 ? now_ns() : 0;
+        if(sink->len == 0){
+            sink->oldest = now;
+        }
+        for(int i = 0; i < count; i++){
+            memcpy(sink->buffer + sink->len, parts[i].iov_base, parts[i].iov_len);
+            sink->len += parts[i].iov_len;
+        }
+        if(sink->len == sink->cap || (sink->flush_ns > 0 && now - sink->oldest >= sink->flush_ns)){
+            err = write_out(sink, NULL, 0);
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return err;
+}
+
+const char* output_sink_flush(output_sink_t* sink){
+    pthread_mutex_lock(&sink->lock);
+    const char* err = sink->len > 0 ? write_out(sink, NULL, 0) : NULL;
+    pthread_mutex_unlock(&sink->lock);
+    return err;
+}
+
+void output_sink_destroy(output_sink_t* sink){
+    output_sink_flush(sink);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->buffer);
+    sink->buffer = NULL;
+    sink->cap = 0;
+}
@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+/**
+ * Buffered line writer for one file descriptor, shared by any number of
+ * threads. Each record goes out whole and in the order it was written, many
+ * records to one write: the buffer is written when the next record would not
+ * fit (together with that record, in one writev), when a write finds the
+ * oldest buffered record older than flush_ns, and on output_sink_flush
+ */
+typedef struct
+{
+    int fd; /* Where records go */
+    char* buffer; /* Records not written yet */
+    size_t len; /* Bytes in buffer */
+    size_t cap; /* Size of buffer (0 = every record is written at once) */
+    uint64_t flush_ns; /* Age at which buffered records are due (0 = no limit) */
+    uint64_t oldest; /* When the first buffered record came in (CLOCK_MONOTONIC ns) */
+    int error; /* errno of the first failed write, 0 while all went well */
+    pthread_mutex_t lock; /* Keeps records whole and in order */
+} output_sink_t;
+/**
+ * Set up a sink
+ * @param sink Pointer to sink structure
+ * @param fd File descriptor to write to (not closed by the sink)
+ * @param buffer_bytes Buffer size, the most a flush writes besides one
+ * oversized record; 0 writes every record as it comes
+ * @param flush_ns Longest a record waits in the buffer while more are being
+ * written, 0 for no limit (idle writers call output_sink_flush)
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_init(output_sink_t* sink, int fd, size_t buffer_bytes, uint64_t flush_ns);
+/**
+ * Add one record, made of parts written back to back
+ * @param sink Pointer to sink structure
+ * @param parts Pieces of the record (copied, or written before returning)
+ * @param count Number of pieces
+ * @return NULL on success, error message if a write failed
+ */
+const char* output_sink_write(output_sink_t* sink, const struct iovec* parts, int count);
+/**
+ * Write out everything buffered
+ * @param sink Pointer to sink structure
+ * @return NULL on success, error message if the write failed
+ */
+const char* output_sink_flush(output_sink_t* sink);
+/**
+ * Flush and free the sink
+ * @param sink Pointer to sink structure
+ */
+void output_sink_destroy(output_sink_t* sink);
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "output_sink.h"
+
+#define TEST_SINK_FILE "/tmp/output_sink_test.txt"
+
+// one record of three parts, the way the logger writes a line
+static void write_line(output_sink_t* sink, const char* text) {
+    struct iovec parts[3] = {
+        { "[test] ", 7 },
+        { (void*)text, strlen(text) },
+        { "\n", 1 },
+    };
+    output_sink_write(sink, parts, 3);
+}
+
+// bytes readable from a nonblocking pipe right now
+static size_t drain_pipe(int fd, char* out, size_t size) {
+    size_t total = 0;
+    ssize_t n;
+    while (total < size - 1 && (n = read(fd, out + total, size - 1 - total)) > 0) {
+        total += (size_t)n;
+    }
+    out[total] = '\0';
+    return total;
+}
+
+// test1 - records wait in the buffer until it fills, then go out whole and in order
+void run_test1_buffering() {
+    printf("=== Test 1: Buffering ===\n");
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("[Test 1] FAIL: no pipe\n");
+        return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    output_sink_t sink;
+    output_sink_init(&sink, fds[1], 32, 0);
+    char got[256];
+    write_line(&sink, "one");
+    write_line(&sink, "two");
+    int ok = drain_pipe(fds[0], got, sizeof(got)) == 0;
+    //"[test] three\n" does not fit after 22 buffered bytes: all three go out
+    write_line(&sink, "three");
+    drain_pipe(fds[0], got, sizeof(got));
+    ok = ok && strcmp(got, "[test] one\n[test] two\n[test] three\n") == 0;
+    printf("[Test 1] %s\n", ok ? "PASS: held until full, then written in order" : "FAIL: buffering");
+    //a record bigger than the whole buffer is written straight through
+    write_line(&sink, "a");
+    write_line(&sink, "this line is longer than the thirty-two byte buffer");
+    drain_pipe(fds[0], got, sizeof(got));
+    ok = strcmp(got, "[test] a\n[test] this line is longer than the thirty-two byte buffer\n") == 0;
+    write_line(&sink, "last");
+    output_sink_flush(&sink);
+    drain_pipe(fds[0], got, sizeof(got));
+    ok = ok && strcmp(got, "[test] last\n") == 0;
+    printf("[Test 1] %s\n", ok ? "PASS: oversized record and flush" : "FAIL: oversized record or flush");
+    output_sink_destroy(&sink);
+    close(fds[0]);
+    close(fds[1]);
+    printf("=== Test 1 Complete ===\n\n");
+}
+
+// test2 - a record older than flush_ns goes out with the next write
+void run_test2_age() {
+    printf("=== Test 2: Flush by age ===\n");
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("[Test 2] FAIL: no pipe\n");
+        return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    output_sink_t sink;
+    output_sink_init(&sink, fds[1], 4096, 5000000);
+    char got[256];
+    write_line(&sink, "early");
+    int ok = drain_pipe(fds[0], got, sizeof(got)) == 0;
+    struct timespec nap = { 0, 10000000 };
+    nanosleep(&nap, NULL);
+    write_line(&sink, "late");
+    drain_pipe(fds[0], got, sizeof(got));
+    ok = ok && strcmp(got, "[test] early\n[test] late\n") == 0;
+    printf("[Test 2] %s\n", ok ? "PASS: 10 ms old record flushed by the next write" : "FAIL: age limit ignored");
+    output_sink_destroy(&sink);
+    close(fds[0]);
+    close(fds[1]);
+    printf("=== Test 2 Complete ===\n\n");
+}
+
+#define TEST_WRITERS 4
+#define TEST_RECORDS 20000
+
+static output_sink_t shared;
+
+static void* writer_thread(void* arg) {
+    int id = (int)(size_t)arg;
+    char text[32];
+    for (int i = 0; i < TEST_RECORDS; i++) {
+        snprintf(text, sizeof(text), "%d %d", id, i);
+        write_line(&shared, text);
+    }
+    return NULL;
+}
+
+// test3 - concurrent writers: every record whole, each writer's in its order
+void run_test3_concurrent() {
+    printf("=== Test 3: Concurrent writers ===\n");
+    int fd = open(TEST_SINK_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    output_sink_init(&shared, fd, 4096, 0);
+    pthread_t threads[TEST_WRITERS];
+    for (int i = 0; i < TEST_WRITERS; i++) {
+        pthread_create(&threads[i], NULL, writer_thread, (void*)(size_t)i);
+    }
+    for (int i = 0; i < TEST_WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    output_sink_destroy(&shared);
+    close(fd);
+    FILE* file = fopen(TEST_SINK_FILE, "r");
+    int next[TEST_WRITERS] = { 0 };
+    int ok = file != NULL;
+    int lines = 0;
+    char line[64];
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        int id, n;
+        if (sscanf(line, "[test] %d %d", &id, &n) != 2 || id < 0 || id >= TEST_WRITERS || n != next[id]) {
+            ok = 0;
+            break;
+        }
+        next[id]++;
+        lines++;
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    ok = ok && lines == TEST_WRITERS * TEST_RECORDS;
+    printf("[Test 3] %s\n", ok ? "PASS: 4 x 20000 records whole and in order" : "FAIL: records lost, torn or reordered");
+    remove(TEST_SINK_FILE);
+    printf("=== Test 3 Complete ===\n\n");
+}
+
+int main() {
+    run_test1_buffering();
+    run_test2_age();
+    run_test3_concurrent();
+    return 0;
+}
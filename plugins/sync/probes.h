@@ -0,0 +1,65 @@
+#include <stdint.h>
+/**
+ * USDT (SystemTap-style) static probes, provider "analyzer". A probe is one
+ * nop plus an ELF note naming it and saying where its arguments live; tools
+ * such as bpftrace or perf find the notes and patch the nop only while they
+ * are attached:
+ *   bpftrace -e 'usdt:./output/uppercaser.so:analyzer:queue_put { @[arg0] = count(); }'
+ * Every argument is read as a 64-bit value (pointers and sizes alike).
+ * <sys/sdt.h> is used when installed; without it the notes are written here
+ * in the same format (x86-64 and aarch64 ELF), elsewhere probes compile to
+ * nothing. Define ANALYZER_NO_PROBES to leave them out altogether
+ */
+#if defined(ANALYZER_NO_PROBES)
+#define ANALYZER_PROBES_NONE 1
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define ANALYZER_PROBES_SDT 1
+#endif
+#endif
+
+#if defined(ANALYZER_PROBES_SDT)
+#include <sys/sdt.h>
+#define ANALYZER_PROBE1(name, a) DTRACE_PROBE1(analyzer, name, (uintptr_t)(a))
+#define ANALYZER_PROBE2(name, a, b) DTRACE_PROBE2(analyzer, name, (uintptr_t)(a), (uintptr_t)(b))
+#define ANALYZER_PROBE3(name, a, b, c) DTRACE_PROBE3(analyzer, name, (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c))
+#elif !defined(ANALYZER_PROBES_NONE) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+//the layout of <sys/sdt.h> version 3 notes: probe address, address of
+//.stapsdt.base (lets tools undo prelinking), semaphore (none), provider,
+//name, then "size@operand" per argument. the operand is printed by the
+//compiler ("nor": a register, memory or a constant), so it is wherever the
+//value already is and firing costs no extra instructions
+#define ANALYZER_PROBE_ASM(name, args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f, 994f-993f, 3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: .8byte 990b\n" \
+    ".8byte _.stapsdt.base\n" \
+    ".8byte 0\n" \
+    ".asciz \"analyzer\"\n" \
+    ".asciz \"" #name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base, 1\n" \
+    ".popsection\n" \
+    ".endif\n"
+#define ANALYZER_PROBE1(name, a) \
+    __asm__ __volatile__(ANALYZER_PROBE_ASM(name, "8@%0") :: "nor"((uintptr_t)(a)))
+#define ANALYZER_PROBE2(name, a, b) \
+    __asm__ __volatile__(ANALYZER_PROBE_ASM(name, "8@%0 8@%1") :: "nor"((uintptr_t)(a)), "nor"((uintptr_t)(b)))
+#define ANALYZER_PROBE3(name, a, b, c) \
+    __asm__ __volatile__(ANALYZER_PROBE_ASM(name, "8@%0 8@%1 8@%2") :: "nor"((uintptr_t)(a)), "nor"((uintptr_t)(b)), "nor"((uintptr_t)(c)))
+#else
+#define ANALYZER_PROBE1(name, a) ((void)0)
+#define ANALYZER_PROBE2(name, a, b) ((void)0)
+#define ANALYZER_PROBE3(name, a, b, c) ((void)0)
+#endif
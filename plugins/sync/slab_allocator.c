@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include "slab_allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+//arenas grow in 2 MiB steps, the size of one x86-64 huge page
+#define SLAB_ARENA_SIZE (2u << 20)
+//a refill carves about this many bytes of blocks at once
+#define SLAB_REFILL_BYTES (64u << 10)
+#define SLAB_LARGE_CLASS 0xffffffffu
+
+/**
+ * Header in front of every block; 16 bytes keeps the payload 16-byte aligned
+ */
+typedef struct
+{
+    slab_cache_t* owner; /* Cache the block returns to (NULL for large blocks) */
+    uint32_t size_class; /* Index into owner->classes, or SLAB_LARGE_CLASS */
+    uint32_t reserved;
+} slab_header_t;
+
+static __thread slab_cache_t* thread_cache;
+
+static int size_class_of(size_t size){
+    size_t total = size + sizeof(slab_header_t);
+    int shift = SLAB_MIN_SHIFT;
+    while(((size_t)1 << shift) < total){
+        shift++;
+    }
+    return shift - SLAB_MIN_SHIFT;
+}
+
+//map a new arena; caller holds arena_lock
+static slab_arena_t* map_arena(slab_allocator_t* allocator, size_t size){
+    void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if(allocator->use_hugepages){
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if(base == MAP_FAILED){
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED){
+            fprintf(stderr, "[ERROR] Failed to map slab arena\n");
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if(allocator->use_hugepages){
+            //no reserved huge pages: ask for transparent ones instead
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    atomic_fetch_add(&allocator->arena_maps, 1);
+    slab_arena_t* arena = base;
+    arena->next = allocator->arena;
+    arena->size = size;
+    arena->used = (sizeof(slab_arena_t) + SLAB_CACHE_LINE - 1) & ~(size_t)(SLAB_CACHE_LINE - 1);
+    allocator->arena = arena;
+    return arena;
+}
+
+//carve up to count blocks of block_size bytes; caller holds arena_lock
+static char* carve(slab_allocator_t* allocator, size_t block_size, size_t* count){
+    slab_arena_t* arena = allocator->arena;
+    if(arena == NULL || arena->size - arena->used < block_size){
+        size_t size = allocator->arena_size;
+        while(size < block_size + sizeof(slab_arena_t) + SLAB_CACHE_LINE){
+            size <<= 1;
+        }
+        arena = map_arena(allocator, size);
+        if(arena == NULL){
+            return NULL;
+        }
+    }
+    size_t available = (arena->size - arena->used) / block_size;
+    if(*count > available){
+        *count = available;
+    }
+    char* blocks = (char*)arena + arena->used;
+    arena->used += *count * block_size;
+    return blocks;
+}
+
+int slab_allocator_init(slab_allocator_t* allocator, size_t prealloc_bytes, int use_hugepages){
+    if(pthread_mutex_init(&allocator->arena_lock, NULL) != 0){
+        return -1;
+    }
+    allocator->arena = NULL;
+    allocator->arena_size = SLAB_ARENA_SIZE;
+    allocator->use_hugepages = use_hugepages;
+    allocator->caches = NULL;
+    atomic_init(&allocator->arena_maps, 0);
+    atomic_init(&allocator->large_allocs, 0);
+    if(prealloc_bytes > 0){
+        //round up to whole arenas so huge pages can back all of it
+        size_t size = (prealloc_bytes + SLAB_ARENA_SIZE - 1) & ~(size_t)(SLAB_ARENA_SIZE - 1);
+        if(map_arena(allocator, size) == NULL){
+            pthread_mutex_destroy(&allocator->arena_lock);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void slab_allocator_destroy(slab_allocator_t* allocator){
+    pthread_mutex_lock(&allocator->arena_lock);
+    slab_cache_t* cache = allocator->caches;
+    while(cache != NULL){
+        slab_cache_t* next = cache->next;
+        if(thread_cache == cache){
+            thread_cache = NULL;
+        }
+        free(cache);
+        cache = next;
+    }
+    allocator->caches = NULL;
+    slab_arena_t* arena = allocator->arena;
+    while(arena != NULL){
+        slab_arena_t* next = arena->next;
+        munmap(arena, arena->size);
+        arena = next;
+    }
+    allocator->arena = NULL;
+    pthread_mutex_unlock(&allocator->arena_lock);
+    pthread_mutex_destroy(&allocator->arena_lock);
+}
+
+//the calling thread's cache, created on its first allocation
+static slab_cache_t* get_cache(slab_allocator_t* allocator){
+    slab_cache_t* cache = thread_cache;
+    if(cache != NULL && cache->allocator == allocator){
+        return cache;
+    }
+    cache = aligned_alloc(SLAB_CACHE_LINE, sizeof(slab_cache_t));
+    if(cache == NULL){
+        return NULL;
+    }
+    memset(cache, 0, sizeof(slab_cache_t));
+    cache->allocator = allocator;
+    pthread_mutex_lock(&allocator->arena_lock);
+    cache->next = allocator->caches;
+    allocator->caches = cache;
+    pthread_mutex_unlock(&allocator->arena_lock);
+    thread_cache = cache;
+    return cache;
+}
+
+//refill an empty local list: first take back everything other threads freed,
+//only then carve fresh blocks from the arena
+static void* refill(slab_allocator_t* allocator, slab_cache_t* cache, int index){
+    slab_class_t* cls = &cache->classes[index];
+    void* blocks = atomic_exchange_explicit(&cls->remote, NULL, memory_order_acquire);
+    if(blocks != NULL){
+        return blocks;
+    }
+    size_t block_size = (size_t)1 << (index + SLAB_MIN_SHIFT);
+    size_t count = SLAB_REFILL_BYTES / block_size;
+    if(count == 0){
+        count = 1;
+    }
+    pthread_mutex_lock(&allocator->arena_lock);
+    char* carved = carve(allocator, block_size, &count);
+    pthread_mutex_unlock(&allocator->arena_lock);
+    if(carved == NULL){
+        return NULL;
+    }
+    //link the new blocks into a list, headers filled in once here
+    for(size_t i = 0; i < count; i++){
+        slab_header_t* header = (slab_header_t*)(carved + i * block_size);
+        header->owner = cache;
+        header->size_class = (uint32_t)index;
+        header->reserved = 0;
+        *(void**)(header + 1) = i + 1 < count ? (void*)(carved + (i + 1) * block_size + sizeof(slab_header_t)) : NULL;
+    }
+    return carved + sizeof(slab_header_t);
+}
+
+void* slab_alloc(slab_allocator_t* allocator, size_t size){
+    int index = size_class_of(size);
+    if(index >= SLAB_CLASS_COUNT){
+        slab_header_t* header = malloc(sizeof(slab_header_t) + size);
+        if(header == NULL){
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&allocator->large_allocs, 1, memory_order_relaxed);
+        header->owner = NULL;
+        header->size_class = SLAB_LARGE_CLASS;
+        return header + 1;
+    }
+    slab_cache_t* cache = get_cache(allocator);
+    if(cache == NULL){
+        return NULL;
+    }
+    slab_class_t* cls = &cache->classes[index];
+    void* block = cls->local;
+    if(block == NULL){
+        block = refill(allocator, cache, index);
+        if(block == NULL){
+            return NULL;
+        }
+    }
+    cls->local = *(void**)block;
+    return block;
+}
+
+void slab_free(slab_allocator_t* allocator, void* ptr){
+    (void)allocator;
+    if(ptr == NULL){
+        return;
+    }
+    slab_header_t* header = (slab_header_t*)ptr - 1;
+    if(header->size_class == SLAB_LARGE_CLASS){
+        free(header);
+        return;
+    }
+    slab_class_t* cls = &header->owner->classes[header->size_class];
+    if(header->owner == thread_cache){
+        *(void**)ptr = cls->local;
+        cls->local = ptr;
+        return;
+    }
+    //another thread's block: push it onto the owner's remote stack. the owner
+    //only ever takes the whole stack with an exchange, so there is no ABA
+    void* head = atomic_load_explicit(&cls->remote, memory_order_relaxed);
+    do{
+        *(void**)ptr = head;
+    }while(!atomic_compare_exchange_weak_explicit(&cls->remote, &head, ptr,
+                                                  memory_order_release, memory_order_relaxed));
+}
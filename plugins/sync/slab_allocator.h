@@ -0,0 +1,77 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#define SLAB_CACHE_LINE 64
+#define SLAB_MIN_SHIFT 4 /* Smallest size class: 16 bytes */
+#define SLAB_MAX_SHIFT 20 /* Largest size class: 1 MiB, bigger requests go to malloc */
+#define SLAB_CLASS_COUNT (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+/**
+ * Free lists of one size class inside a thread cache
+ * local is only touched by the owning thread; remote is a lock-free stack that
+ * other threads push freed blocks onto, on its own cache line
+ */
+typedef struct
+{
+    void* local; /* Blocks ready for the owner (no synchronization) */
+    _Alignas(SLAB_CACHE_LINE) _Atomic(void*) remote; /* Blocks freed by other threads */
+} slab_class_t;
+/**
+ * Per-thread cache: every block remembers the cache it was carved for, so a
+ * block freed on a downstream thread goes back to the stage that allocated it
+ */
+typedef struct slab_cache
+{
+    slab_class_t classes[SLAB_CLASS_COUNT];
+    struct slab_allocator* allocator; /* Allocator this cache belongs to */
+    struct slab_cache* next; /* All caches of an allocator, for destroy */
+} slab_cache_t;
+/**
+ * Arena: one large mapping that size-class blocks are carved from
+ */
+typedef struct slab_arena
+{
+    struct slab_arena* next; /* Previously filled arenas */
+    size_t size; /* Bytes mapped */
+    size_t used; /* Bytes carved so far */
+} slab_arena_t;
+/**
+ * Size-class slab allocator for message buffers
+ */
+typedef struct slab_allocator
+{
+    pthread_mutex_t arena_lock; /* Guards arena carving and the cache list */
+    slab_arena_t* arena; /* Arena currently carved from */
+    size_t arena_size; /* Size of each additional arena */
+    int use_hugepages; /* Map arenas with MAP_HUGETLB when possible */
+    slab_cache_t* caches; /* Every thread cache created so far */
+    atomic_size_t arena_maps; /* Number of arena mappings made (system calls) */
+    atomic_size_t large_allocs; /* Requests above the largest class (went to malloc) */
+} slab_allocator_t;
+/**
+ * Initialize an allocator
+ * @param allocator Pointer to allocator structure
+ * @param prealloc_bytes Bytes to map up front (0 maps on first use)
+ * @param use_hugepages Nonzero to back arenas with huge pages when available
+ * @return 0 on success, -1 on failure
+ */
+int slab_allocator_init(slab_allocator_t* allocator, size_t prealloc_bytes, int use_hugepages);
+/**
+ * Destroy an allocator, unmapping every arena. All blocks become invalid
+ * @param allocator Pointer to allocator structure
+ */
+void slab_allocator_destroy(slab_allocator_t* allocator);
+/**
+ * Allocate a block of at least size bytes from the calling thread's cache
+ * @param allocator Pointer to allocator structure
+ * @param size Number of bytes
+ * @return The block, or NULL on failure
+ */
+void* slab_alloc(slab_allocator_t* allocator, size_t size);
+/**
+ * Free a block from slab_alloc. May be called from any thread: the block goes
+ * straight back to the cache of the thread that allocated it
+ * @param allocator Pointer to allocator structure
+ * @param ptr Block to free (NULL is ignored)
+ */
+void slab_free(slab_allocator_t* allocator, void* ptr);
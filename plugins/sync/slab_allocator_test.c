@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "slab_allocator.h"
+
+// test1 - a freed block is handed out again, sizes land in the right class
+void run_test1_reuse() {
+    printf("=== Test 1: Same-thread reuse ===\n");
+    slab_allocator_t allocator;
+    slab_allocator_init(&allocator, 0, 0);
+    char* a = slab_alloc(&allocator, 100);
+    memset(a, 'x', 100);
+    slab_free(&allocator, a);
+    char* b = slab_alloc(&allocator, 90);
+    char* big = slab_alloc(&allocator, 2 << 20);
+    printf("[Test 1] %s\n", a == b ? "PASS: block reused" : "FAIL: block not reused");
+    printf("[Test 1] %s\n", ((size_t)b & 15) == 0 ? "PASS: 16-byte aligned" : "FAIL: misaligned");
+    printf("[Test 1] %s\n", big != NULL && atomic_load(&allocator.large_allocs) == 1 ? "PASS: large block from malloc" : "FAIL: large block");
+    slab_free(&allocator, b);
+    slab_free(&allocator, big);
+    slab_allocator_destroy(&allocator);
+    printf("=== Test 1 Complete ===\n\n");
+}
+
+// test2 - blocks freed on another thread return to the thread that allocated them
+#define TEST2_BLOCKS 1000
+static char* test2_blocks[TEST2_BLOCKS];
+void* remote_free_thread(void* arg) {
+    slab_allocator_t* allocator = arg;
+    for (int i = 0; i < TEST2_BLOCKS; i++) {
+        slab_free(allocator, test2_blocks[i]);
+    }
+    return NULL;
+}
+static int compare_pointers(const void* a, const void* b) {
+    char* x = *(char* const*)a;
+    char* y = *(char* const*)b;
+    return (x > y) - (x < y);
+}
+void run_test2_remote_free() {
+    printf("=== Test 2: Cross-thread free returns to owner ===\n");
+    slab_allocator_t allocator;
+    slab_allocator_init(&allocator, 0, 0);
+    for (int i = 0; i < TEST2_BLOCKS; i++) {
+        test2_blocks[i] = slab_alloc(&allocator, 48);
+    }
+    char* before[TEST2_BLOCKS];
+    memcpy(before, test2_blocks, sizeof(before));
+    //drain the local list so the next allocations must come from remote frees
+    int extra = 0;
+    char* extras[4096];
+    while (allocator.caches->classes[2].local != NULL && extra < 4096) {
+        extras[extra++] = slab_alloc(&allocator, 48);
+    }
+    pthread_t t;
+    pthread_create(&t, NULL, remote_free_thread, &allocator);
+    pthread_join(t, NULL);
+    size_t maps = atomic_load(&allocator.arena_maps);
+    for (int i = 0; i < TEST2_BLOCKS; i++) {
+        test2_blocks[i] = slab_alloc(&allocator, 48);
+    }
+    qsort(before, TEST2_BLOCKS, sizeof(char*), compare_pointers);
+    qsort(test2_blocks, TEST2_BLOCKS, sizeof(char*), compare_pointers);
+    int same = memcmp(before, test2_blocks, sizeof(before)) == 0;
+    printf("[Test 2] %s\n", same ? "PASS: remote frees recycled" : "FAIL: remote frees not recycled");
+    printf("[Test 2] %s\n", atomic_load(&allocator.arena_maps) == maps ? "PASS: no new arena" : "FAIL: arena grew");
+    for (int i = 0; i < extra; i++) {
+        slab_free(&allocator, extras[i]);
+    }
+    slab_allocator_destroy(&allocator);
+    printf("=== Test 2 Complete ===\n\n");
+}
+
+// test3 - a producer/consumer pair ping-pongs buffers with no arena growth in steady state
+#define TEST3_ROUNDS 200000
+#define TEST3_INFLIGHT 64
+static char* volatile test3_slots[TEST3_INFLIGHT];
+void* consumer_free_thread(void* arg) {
+    slab_allocator_t* allocator = arg;
+    for (int i = 0; i < TEST3_ROUNDS; i++) {
+        char* block;
+        while ((block = __atomic_exchange_n(&test3_slots[i % TEST3_INFLIGHT], NULL, __ATOMIC_ACQUIRE)) == NULL) {
+            sched_yield();
+        }
+        slab_free(allocator, block);
+    }
+    return NULL;
+}
+void run_test3_steady_state() {
+    printf("=== Test 3: Steady state without arena growth ===\n");
+    slab_allocator_t allocator;
+    slab_allocator_init(&allocator, 1 << 20, 0);
+    pthread_t t;
+    pthread_create(&t, NULL, consumer_free_thread, &allocator);
+    size_t warm = 0;
+    for (int i = 0; i < TEST3_ROUNDS; i++) {
+        if (i == TEST3_ROUNDS / 2) {
+            warm = atomic_load(&allocator.arena_maps);
+        }
+        char* block = slab_alloc(&allocator, 1 + i % 900);
+        block[0] = 'a';
+        while (__atomic_load_n(&test3_slots[i % TEST3_INFLIGHT], __ATOMIC_ACQUIRE) != NULL) {
+            sched_yield();
+        }
+        __atomic_store_n(&test3_slots[i % TEST3_INFLIGHT], block, __ATOMIC_RELEASE);
+    }
+    pthread_join(t, NULL);
+    printf("[Test 3] arena mappings: %zu\n", atomic_load(&allocator.arena_maps));
+    printf("[Test 3] %s\n", atomic_load(&allocator.arena_maps) == warm ? "PASS: no mappings after warm-up" : "FAIL: arena kept growing");
+    slab_allocator_destroy(&allocator);
+    printf("=== Test 3 Complete ===\n\n");
+}
+
+int main() {
+    run_test1_reuse();
+    run_test2_remote_free();
+    run_test3_steady_state();
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "spsc_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int spsc_ring_init(spsc_ring_t* ring, int capacity){
+    if(capacity <= 0){
+        return -1;
+    }
+    //round the slot count up to a power of two so an index is just (i & mask)
+    size_t slots = 1;
+    while(slots < (size_t)capacity){
+        slots <<= 1;
+    }
+    ring->slots = calloc(slots, sizeof(char*));
+    if(ring->slots == NULL){
+        fprintf(stderr, "[ERROR] Failed to allocate ring slots\n");
+        return -1;
+    }
+    ring->mask = slots - 1;
+    ring->limit = (size_t)capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->cached_head = 0;
+    ring->cached_tail = 0;
+    return 0;
+}
+
+void spsc_ring_destroy(spsc_ring_t* ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for(size_t i = head; i != tail; i++){
+        free(ring->slots[i & ring->mask]);
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int spsc_ring_try_push(spsc_ring_t* ring, char* item){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    //only reload head (the consumer's line) when our cached copy says full
+    if(tail - ring->cached_head >= ring->limit){
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(tail - ring->cached_head >= ring->limit){
+            return 0;
+        }
+    }
+    ring->slots[tail & ring->mask] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+char* spsc_ring_try_pop(spsc_ring_t* ring){
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    //only reload tail (the producer's line) when our cached copy says empty
+    if(head == ring->cached_tail){
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if(head == ring->cached_tail){
+            return NULL;
+        }
+    }
+    char* item = ring->slots[head & ring->mask];
+    ring->slots[head & ring->mask] = NULL;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return item;
+}
+
+size_t spsc_ring_size(spsc_ring_t* ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return tail - head;
+}
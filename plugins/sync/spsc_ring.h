@@ -0,0 +1,49 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#define SPSC_CACHE_LINE 64
+/**
+ * Lock-free single-producer/single-consumer ring of string pointers
+ * head is only written by the consumer and tail only by the producer, each on
+ * its own cache line so the two threads never write to a shared line
+ */
+typedef struct
+{
+    char** slots; /* Array of string pointers (power-of-two length) */
+    size_t mask; /* Number of slots - 1 */
+    size_t limit; /* Maximum number of items (may be less than the slot count) */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head; /* Index of next item to pop (consumer) */
+    size_t cached_tail; /* Consumer's last seen value of tail */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail; /* Index of next insertion point (producer) */
+    size_t cached_head; /* Producer's last seen value of head */
+} spsc_ring_t;
+/**
+ * Initialize a ring that holds at most capacity items
+ * @param ring Pointer to ring structure (must be SPSC_CACHE_LINE aligned)
+ * @param capacity Maximum number of items
+ * @return 0 on success, -1 on failure
+ */
+int spsc_ring_init(spsc_ring_t* ring, int capacity);
+/**
+ * Destroy a ring, freeing any items still inside it
+ * @param ring Pointer to ring structure
+ */
+void spsc_ring_destroy(spsc_ring_t* ring);
+/**
+ * Push an item without blocking (producer thread only)
+ * @param ring Pointer to ring structure
+ * @param item Item to push (ring takes ownership on success)
+ * @return 1 if the item was pushed, 0 if the ring is full
+ */
+int spsc_ring_try_push(spsc_ring_t* ring, char* item);
+/**
+ * Pop an item without blocking (consumer thread only)
+ * @param ring Pointer to ring structure
+ * @return The item, or NULL if the ring is empty
+ */
+char* spsc_ring_try_pop(spsc_ring_t* ring);
+/**
+ * Number of items currently in the ring (approximate while both sides run)
+ * @param ring Pointer to ring structure
+ * @return Item count
+ */
+size_t spsc_ring_size(spsc_ring_t* ring);
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include "stage_stats.h"
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//the calling thread's perf events: cycles leads a group with instructions
+//and cache misses, so one read gets all three. -2 until the first try, -1
+//when perf_event_open is not available
+static __thread int perf_fds[3] = { -2, -1, -1 };
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+static void perf_close(void* unused){
+    (void)unused;
+    for(int i = 0; i < 3; i++){
+        if(perf_fds[i] >= 0){
+            close(perf_fds[i]);
+        }
+        perf_fds[i] = -1;
+    }
+}
+
+static void perf_key_create(void){
+    pthread_key_create(&perf_key, perf_close);
+}
+
+static int perf_open(uint64_t config, int group){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    //user space only: allowed at perf_event_paranoid 2, the usual default
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+//all three counters or none
+static void perf_open_thread(void){
+    static const uint64_t events[3] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+    for(int i = 0; i < 3; i++){
+        perf_fds[i] = perf_open(events[i], i == 0 ? -1 : perf_fds[0]);
+        if(perf_fds[i] < 0){
+            perf_close(NULL);
+            return;
+        }
+    }
+    pthread_once(&perf_once, perf_key_create);
+    pthread_setspecific(perf_key, perf_fds);
+}
+
+//values below HISTOGRAM_SUB_COUNT get a bucket each; above, every power of
+//two gets HISTOGRAM_SUB_COUNT buckets, picked by the bits after the top one
+static inline int bucket_of(uint64_t value){
+    if(value < HISTOGRAM_SUB_COUNT){
+        return (int)value;
+    }
+    int top = 63 - __builtin_clzll(value);
+    int shift = top - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+//smallest value of a bucket, and how many values it spans
+static void bucket_range(int bucket, uint64_t* low, uint64_t* width){
+    int group = bucket / HISTOGRAM_SUB_COUNT;
+    uint64_t sub = (uint64_t)(bucket % HISTOGRAM_SUB_COUNT);
+    if(group == 0){
+        *low = sub;
+        *width = 1;
+        return;
+    }
+    *low = ((uint64_t)HISTOGRAM_SUB_COUNT + sub) << (group - 1);
+    *width = (uint64_t)1 << (group - 1);
+}
+
+void histogram_record(histogram_t* histogram, uint64_t value){
+    atomic_fetch_add_explicit(&histogram->counts[bucket_of(value)], 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while(value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed)){
+    }
+}
+
+uint64_t histogram_count(histogram_t* histogram){
+    uint64_t total = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+        total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t histogram_percentile(histogram_t* histogram, double percentile){
+    uint64_t total = histogram_count(histogram);
+    if(total == 0){
+        return 0;
+    }
+    //rank of the value we want, 1-based; writers may be adding meanwhile, so
+    //running off the end falls back to the maximum
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+    if(rank < 1){
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if(seen >= rank){
+            uint64_t low, width;
+            bucket_range(i, &low, &width);
+            uint64_t value = low + width / 2;
+            uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            return value < max ? value : max;
+        }
+    }
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+void stage_cpu_read(stage_cpu_t* out){
+    memset(out, 0, sizeof(stage_cpu_t));
+    struct timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0){
+        out->cpu_ns = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    }
+    struct rusage usage;
+    if(getrusage(RUSAGE_THREAD, &usage) == 0){
+        out->waits = (uint64_t)usage.ru_nvcsw;
+    }
+    if(perf_fds[0] == -2){
+        perf_open_thread();
+    }
+    if(perf_fds[0] < 0){
+        return;
+    }
+    struct
+    {
+        uint64_t nr;
+        uint64_t enabled;
+        uint64_t running;
+        uint64_t values[3];
+    } group;
+    if(read(perf_fds[0], &group, sizeof(group)) != (ssize_t)sizeof(group) || group.running == 0){
+        return;
+    }
+    //the kernel multiplexes counters when there are more than the PMU has;
+    //scale up to the time the group was enabled
+    double scale = group.running < group.enabled ? (double)group.enabled / (double)group.running : 1.0;
+    out->cycles = (uint64_t)(group.values[0] * scale);
+    out->instructions = (uint64_t)(group.values[1] * scale);
+    out->cache_misses = (uint64_t)(group.values[2] * scale);
+    out->hardware = 1;
+}
+
+void stage_stats_cpu_add(stage_stats_t* stats, const stage_cpu_t* start, const stage_cpu_t* end){
+    atomic_fetch_add_explicit(&stats->cpu_ns, end->cpu_ns - start->cpu_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->waits, end->waits - start->waits, memory_order_relaxed);
+    if(start->hardware && end->hardware){
+        atomic_fetch_add_explicit(&stats->cycles, end->cycles - start->cycles, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->instructions, end->instructions - start->instructions, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->cache_misses, end->cache_misses - start->cache_misses, memory_order_relaxed);
+        atomic_store_explicit(&stats->hardware, 1, memory_order_relaxed);
+    }
+}
+
+void stage_stats_item_in(stage_stats_t* stats, size_t bytes, uint64_t queued_at, uint64_t now){
+    atomic_fetch_add_explicit(&stats->items_in, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_in, bytes, memory_order_relaxed);
+    if(queued_at != 0 && now >= queued_at){
+        histogram_record(&stats->queue_wait, now - queued_at);
+    }
+}
+
+void stage_stats_item_out(stage_stats_t* stats, size_t bytes){
+    atomic_fetch_add_explicit(&stats->items_out, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_out, bytes, memory_order_relaxed);
+}
+
+//a duration in the unit that keeps it short: 850ns, 12.4us, 3.1ms, 2.0s
+static void format_ns(char* buf, size_t size, uint64_t ns){
+    if(ns < 1000){
+        snprintf(buf, size, "%uns", (unsigned)ns);
+    }else if(ns < 1000000){
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    }else if(ns < 1000000000){
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    }else{
+        snprintf(buf, size, "%.1fs", ns / 1e9);
+    }
+}
+
+//"p50/p99/p99.9" of one histogram, or "-" when it is empty
+static void format_latency(char* buf, size_t size, histogram_t* histogram){
+    if(histogram_count(histogram) == 0){
+        snprintf(buf, size, "-");
+        return;
+    }
+    char p50[16], p99[16], p999[16];
+    format_ns(p50, sizeof(p50), histogram_percentile(histogram, 50.0));
+    format_ns(p99, sizeof(p99), histogram_percentile(histogram, 99.0));
+    format_ns(p999, sizeof(p999), histogram_percentile(histogram, 99.9));
+    snprintf(buf, size, "%s/%s/%s", p50, p99, p999);
+}
+
+void stage_stats_report(FILE* out, const char* const* names, stage_stats_t* const* stats, int count, double seconds){
+    fprintf(out, "Stage statistics after %.3f s (latencies p50/p99/p99.9)\n", seconds);
+    fprintf(out, "%-12s %10s %10s %12s %12s %10s  %-24s %-24s %-24s\n",
+            "stage", "items in", "items out", "bytes in", "bytes out", "items/s", "queue wait", "transform", "forward");
+    for(int i = 0; i < count; i++){
+        stage_stats_t* s = stats[i];
+        uint64_t out_items = atomic_load_explicit(&s->items_out, memory_order_relaxed);
+        char wait[48], transform[48], forward[48];
+        format_latency(wait, sizeof(wait), &s->queue_wait);
+        format_latency(transform, sizeof(transform), &s->transform);
+        format_latency(forward, sizeof(forward), &s->forward);
+        fprintf(out, "%-12s %10llu %10llu %12llu %12llu %10.0f  %-24s %-24s %-24s\n", names[i],
+                (unsigned long long)atomic_load_explicit(&s->items_in, memory_order_relaxed),
+                (unsigned long long)out_items,
+                (unsigned long long)atomic_load_explicit(&s->bytes_in, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&s->bytes_out, memory_order_relaxed),
+                seconds > 0 ? out_items / seconds : 0.0, wait, transform, forward);
+    }
+    fflush(out);
+}
+
+void stage_stats_cpu_report(FILE* out, const char* const* names, stage_stats_t* const* stats, int count, double seconds){
+    fprintf(out, "Stage CPU after %.3f s\n", seconds);
+    fprintf(out, "%-12s %10s %6s %10s %12s %6s %12s %11s\n",
+            "stage", "cpu ms", "busy", "ns/item", "cycles/item", "IPC", "misses/item", "waits/item");
+    int hardware = 0;
+    for(int i = 0; i < count; i++){
+        stage_stats_t* s = stats[i];
+        uint64_t items = atomic_load_explicit(&s->items_in, memory_order_relaxed);
+        uint64_t cpu = atomic_load_explicit(&s->cpu_ns, memory_order_relaxed);
+        uint64_t waits = atomic_load_explicit(&s->waits, memory_order_relaxed);
+        uint64_t cycles = atomic_load_explicit(&s->cycles, memory_order_relaxed);
+        uint64_t instructions = atomic_load_explicit(&s->instructions, memory_order_relaxed);
+        uint64_t misses = atomic_load_explicit(&s->cache_misses, memory_order_relaxed);
+        char perItem[16] = "-", cyclesPerItem[16] = "-", ipc[16] = "-", missesPerItem[16] = "-", waitsPerItem[16] = "-";
+        if(items > 0){
+            snprintf(perItem, sizeof(perItem), "%.0f", (double)cpu / items);
+            snprintf(waitsPerItem, sizeof(waitsPerItem), "%.2f", (double)waits / items);
+        }
+        if(atomic_load_explicit(&s->hardware, memory_order_relaxed)){
+            hardware = 1;
+            if(items > 0){
+                snprintf(cyclesPerItem, sizeof(cyclesPerItem), "%.0f", (double)cycles / items);
+                snprintf(missesPerItem, sizeof(missesPerItem), "%.2f", (double)misses / items);
+            }
+            if(cycles > 0){
+                snprintf(ipc, sizeof(ipc), "%.2f", (double)instructions / cycles);
+            }
+        }
+        fprintf(out, "%-12s %10.1f %5.1f%% %10s %12s %6s %12s %11s\n", names[i], cpu / 1e6,
+                seconds > 0 ? cpu / 1e9 / seconds * 100.0 : 0.0, perItem, cyclesPerItem, ipc, missesPerItem, waitsPerItem);
+    }
+    if(!hardware){
+        fprintf(out, "(no hardware counters here: perf_event_open is not available, CPU time and waits only)\n");
+    }
+    fflush(out);
+}
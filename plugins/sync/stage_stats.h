@@ -0,0 +1,142 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+// Histogram resolution: each power of two is split into 2^HISTOGRAM_SUB_BITS
+// buckets, so a recorded value is known to within about 3%
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+/**
+ * Log-linear (HDR-style) histogram of 64-bit values. Recording is one atomic
+ * add, so any number of threads may record while another one reads
+ */
+typedef struct
+{
+    atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS]; /* Values per bucket */
+    atomic_uint_fast64_t max; /* Largest value recorded */
+} histogram_t;
+/**
+ * CPU a thread has used so far. The hardware counts are only there where
+ * perf_event_open works (a PMU, perf_event_paranoid <= 2, no seccomp filter);
+ * otherwise they stay 0 and hardware is 0
+ */
+typedef struct
+{
+    uint64_t cpu_ns; /* CLOCK_THREAD_CPUTIME_ID */
+    uint64_t waits; /* Voluntary context switches, i.e. times the thread slept (getrusage) */
+    uint64_t cycles; /* CPU cycles in user space */
+    uint64_t instructions; /* Instructions retired in user space */
+    uint64_t cache_misses; /* Last-level cache misses in user space */
+    int hardware; /* The three counts above are valid */
+} stage_cpu_t;
+/**
+ * A stage's input queue at one moment, as the host's --metrics socket reports it
+ */
+typedef struct
+{
+    int depth; /* Items queued */
+    int capacity; /* Items the queue holds at most */
+    size_t bytes; /* Payload bytes queued */
+    int waiting_consumers; /* Threads parked because the queue is empty */
+    int waiting_producers; /* Threads parked because the queue is full */
+} stage_queue_sample_t;
+/**
+ * What one pipeline stage did, for the host's --stats table. Times are in
+ * nanoseconds; the stage's worker threads (if any) share one block
+ */
+typedef struct stage_stats
+{
+    atomic_uint_fast64_t items_in; /* Data items taken off the input queue */
+    atomic_uint_fast64_t items_out; /* Data items the transforms produced */
+    atomic_uint_fast64_t bytes_in; /* Payload bytes of items_in */
+    atomic_uint_fast64_t bytes_out; /* Payload bytes of items_out */
+    histogram_t queue_wait; /* From entering the input queue to being taken off it */
+    histogram_t transform; /* Running the transform (and any fused ones) on one item */
+    histogram_t forward; /* Handing a result to the next stage, waiting for room included */
+    atomic_uint_fast64_t cpu_ns; /* CPU time the stage's threads (or tasks) used */
+    atomic_uint_fast64_t waits; /* Times they went to sleep */
+    atomic_uint_fast64_t cycles; /* Hardware counts, where available */
+    atomic_uint_fast64_t instructions;
+    atomic_uint_fast64_t cache_misses;
+    atomic_int hardware; /* Set once hardware counts were added */
+    _Atomic(void*) queue; /* The stage's input queue once it is running, for sample_queue */
+    void (*sample_queue)(void* queue, stage_queue_sample_t* out); /* Reads queue (set before it) */
+} stage_stats_t;
+/**
+ * Monotonic clock in nanoseconds, the time base of every stage_stats_t
+ * @return Current time
+ */
+static inline uint64_t stage_stats_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+/**
+ * Read the calling thread's CPU counters. The first call on a thread opens
+ * its perf events; they are closed when the thread exits
+ * @param out Counters so far
+ */
+void stage_cpu_read(stage_cpu_t* out);
+/**
+ * Charge a stage with the CPU used between two reads on the same thread
+ * @param stats Stage counters
+ * @param start Earlier read
+ * @param end Later read
+ */
+void stage_stats_cpu_add(stage_stats_t* stats, const stage_cpu_t* start, const stage_cpu_t* end);
+/**
+ * Record one value
+ * @param histogram Pointer to histogram
+ * @param value Value to record
+ */
+void histogram_record(histogram_t* histogram, uint64_t value);
+/**
+ * Number of values recorded (sums the buckets, meant for reports)
+ * @param histogram Pointer to histogram
+ * @return Count
+ */
+uint64_t histogram_count(histogram_t* histogram);
+/**
+ * Value below which the given share of recorded values fall
+ * @param histogram Pointer to histogram
+ * @param percentile Share in percent (e.g. 99.9)
+ * @return The value (middle of its bucket), 0 if nothing was recorded
+ */
+uint64_t histogram_percentile(histogram_t* histogram, double percentile);
+/**
+ * Count one item taken off the input queue and the time it spent there
+ * @param stats Stage counters
+ * @param bytes Payload bytes
+ * @param queued_at When it entered the queue (0 = unknown, no wait recorded)
+ * @param now Current stage_stats_now()
+ */
+void stage_stats_item_in(stage_stats_t* stats, size_t bytes, uint64_t queued_at, uint64_t now);
+/**
+ * Count one item a transform produced
+ * @param stats Stage counters
+ * @param bytes Payload bytes
+ */
+void stage_stats_item_out(stage_stats_t* stats, size_t bytes);
+/**
+ * Print one table row per stage: counts, throughput and p50/p99/p99.9 of the
+ * three histograms
+ * @param out Stream to print to
+ * @param names Stage names
+ * @param stats Stage counters, in the same order
+ * @param count Number of stages
+ * @param seconds Time the counters cover, for items per second
+ */
+void stage_stats_report(FILE* out, const char* const* names, stage_stats_t* const* stats, int count, double seconds);
+/**
+ * Print one row per stage of what its CPU time went on: share of the wall
+ * time, ns/item and, with hardware counters, cycles/item, instructions per
+ * cycle and cache misses/item. A stage busy near 100% is compute-bound; a low
+ * share with many waits/item means it spends its time waiting on its queues
+ * @param out Stream to print to
+ * @param names Stage names
+ * @param stats Stage counters, in the same order
+ * @param count Number of stages
+ * @param seconds Wall time the counters cover
+ */
+void stage_stats_cpu_report(FILE* out, const char* const* names, stage_stats_t* const* stats, int count, double seconds);
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "stage_stats.h"
+
+// test1 - percentiles of a known distribution land within the bucket error
+void run_test1_percentiles() {
+    printf("=== Test 1: Percentiles ===\n");
+    histogram_t* histogram = calloc(1, sizeof(histogram_t));
+    for (uint64_t v = 1; v <= 100000; v++) {
+        histogram_record(histogram, v);
+    }
+    double wanted[] = { 50.0, 99.0, 99.9 };
+    int ok = histogram_count(histogram) == 100000;
+    for (int i = 0; i < 3; i++) {
+        double expected = wanted[i] * 1000.0;
+        double got = (double)histogram_percentile(histogram, wanted[i]);
+        if (got < expected * 0.97 || got > expected * 1.03) {
+            printf("[Test 1] p%g of 1..100000 is %.0f\n", wanted[i], got);
+            ok = 0;
+        }
+    }
+    printf("[Test 1] %s\n", ok ? "PASS: p50/p99/p99.9 within 3%" : "FAIL: percentile off");
+    //small values are exact; a bucket's middle is never reported above the maximum
+    histogram_t* exact = calloc(1, sizeof(histogram_t));
+    histogram_record(exact, 7);
+    histogram_record(exact, 7);
+    histogram_record(exact, 1000);
+    uint64_t top = histogram_percentile(exact, 100.0);
+    ok = histogram_percentile(exact, 50.0) == 7 && top <= 1000 && top >= 970;
+    histogram_record(exact, UINT64_MAX);
+    ok = ok && histogram_percentile(exact, 100.0) >= UINT64_MAX / 100 * 97;
+    printf("[Test 1] %s\n", ok ? "PASS: exact small values, top bucket capped, 2^64-1 recorded" : "FAIL: edge values");
+    free(histogram);
+    free(exact);
+    printf("=== Test 1 Complete ===\n\n");
+}
+
+static histogram_t shared;
+
+static void* record_thread(void* arg) {
+    uint64_t base = (uint64_t)(size_t)arg;
+    for (uint64_t i = 0; i < 100000; i++) {
+        histogram_record(&shared, base + i % 1000);
+    }
+    return NULL;
+}
+
+// test2 - concurrent recorders lose nothing
+void run_test2_concurrent() {
+    printf("=== Test 2: Concurrent recording ===\n");
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, record_thread, (void*)(size_t)(i * 1000));
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int ok = histogram_count(&shared) == 400000 && atomic_load(&shared.max) == 3999;
+    printf("[Test 2] %s\n", ok ? "PASS: 4 x 100000 values counted" : "FAIL: values lost");
+    printf("=== Test 2 Complete ===\n\n");
+}
+
+static volatile uint64_t sink;
+
+// test3 - a busy loop is charged as CPU time, a sleep as a wait and not as CPU
+void run_test3_cpu() {
+    printf("=== Test 3: CPU accounting ===\n");
+    stage_stats_t* stats = calloc(1, sizeof(stage_stats_t));
+    stage_cpu_t start, end;
+    stage_cpu_read(&start);
+    uint64_t spin_until = stage_stats_now() + 20000000;
+    while (stage_stats_now() < spin_until) {
+        sink++;
+    }
+    stage_cpu_read(&end);
+    stage_stats_cpu_add(stats, &start, &end);
+    uint64_t busy = atomic_load(&stats->cpu_ns);
+    int ok = busy >= 10000000 && busy <= 1000000000;
+    if (atomic_load(&stats->hardware)) {
+        ok = ok && atomic_load(&stats->cycles) > 0 && atomic_load(&stats->instructions) > 0;
+    }
+    printf("[Test 3] %s (%s)\n", ok ? "PASS: 20 ms of spinning charged" : "FAIL: spinning not charged",
+           atomic_load(&stats->hardware) ? "with hardware counters" : "no hardware counters");
+    stage_cpu_read(&start);
+    struct timespec nap = { 0, 20000000 };
+    nanosleep(&nap, NULL);
+    stage_cpu_read(&end);
+    stage_stats_cpu_add(stats, &start, &end);
+    uint64_t slept = atomic_load(&stats->cpu_ns) - busy;
+    ok = slept < 5000000 && atomic_load(&stats->waits) >= 1;
+    printf("[Test 3] %s\n", ok ? "PASS: 20 ms asleep is a wait, not CPU" : "FAIL: sleep charged as CPU");
+    free(stats);
+    printf("=== Test 3 Complete ===\n\n");
+}
+
+int main() {
+    run_test1_percentiles();
+    run_test2_concurrent();
+    run_test3_cpu();
+    return 0;
+}
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include "task_pool.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TASK_DEQUE_INITIAL 64
+
+//the pool and deque of the calling thread, when it is a pool thread
+static __thread task_pool_t* current_pool;
+static __thread int current_index = -1;
+
+typedef struct
+{
+    task_pool_t* pool;
+    int index;
+} pool_thread_arg_t;
+
+//make room for one more task; caller holds deque->lock
+static int deque_reserve(task_deque_t* deque){
+    if(deque->bottom - deque->top < deque->cap){
+        return 0;
+    }
+    size_t cap = deque->cap * 2;
+    task_t* tasks = malloc(cap * sizeof(task_t));
+    if(tasks == NULL){
+        return -1;
+    }
+    for(size_t i = deque->top; i != deque->bottom; i++){
+        tasks[i & (cap - 1)] = deque->tasks[i & (deque->cap - 1)];
+    }
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->cap = cap;
+    return 0;
+}
+
+static int deque_push(task_deque_t* deque, task_t task, int at_top){
+    pthread_mutex_lock(&deque->lock);
+    if(deque_reserve(deque) != 0){
+        pthread_mutex_unlock(&deque->lock);
+        return -1;
+    }
+    if(at_top){
+        deque->top--;
+        deque->tasks[deque->top & (deque->cap - 1)] = task;
+    }else{
+        deque->tasks[deque->bottom & (deque->cap - 1)] = task;
+        deque->bottom++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+//take the newest (own deque) or the oldest (stealing) task
+static int deque_pop(task_deque_t* deque, task_t* task, int from_top){
+    pthread_mutex_lock(&deque->lock);
+    if(deque->top == deque->bottom){
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    if(from_top){
+        *task = deque->tasks[deque->top & (deque->cap - 1)];
+        deque->top++;
+    }else{
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom & (deque->cap - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+static int find_task(task_pool_t* pool, int index, task_t* task){
+    if(deque_pop(&pool->deques[index], task, 0)){
+        return 1;
+    }
+    //steal, starting with the next thread so victims spread out
+    for(int i = 1; i < pool->count; i++){
+        if(deque_pop(&pool->deques[(index + i) % pool->count], task, 1)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* pool_thread(void* arg){
+    pool_thread_arg_t* self = arg;
+    task_pool_t* pool = self->pool;
+    int index = self->index;
+    free(self);
+    current_pool = pool;
+    current_index = index;
+    while(atomic_load(&pool->running)){
+        task_t task;
+        if(find_task(pool, index, &task)){
+            atomic_fetch_sub(&pool->pending, 1);
+            task.run(task.arg);
+            continue;
+        }
+        //nothing anywhere: park. announce first, then re-check, so a submit
+        //either sees us sleeping or we see its task
+        pthread_mutex_lock(&pool->sleep_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while(atomic_load(&pool->pending) <= 0 && atomic_load(&pool->running)){
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+    return NULL;
+}
+
+const char* task_pool_init(task_pool_t* pool, int threads, int (*thread_cpu)(void)){
+    memset(pool, 0, sizeof(task_pool_t));
+    if(threads < 0){
+        return "Invalid thread count";
+    }
+    //without threads there is still one deque, for task_pool_run_one
+    int deques = threads > 0 ? threads : 1;
+    pool->deques = calloc(deques, sizeof(task_deque_t));
+    pool->threads = threads > 0 ? calloc(threads, sizeof(pthread_t)) : NULL;
+    if(pool->deques == NULL || (threads > 0 && pool->threads == NULL)){
+        free(pool->deques);
+        free(pool->threads);
+        pool->deques = NULL;
+        pool->threads = NULL;
+        return "Memory allocation failed";
+    }
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for(int i = 0; i < deques; i++){
+        pool->deques[i].tasks = malloc(TASK_DEQUE_INITIAL * sizeof(task_t));
+        pool->deques[i].cap = TASK_DEQUE_INITIAL;
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        if(pool->deques[i].tasks == NULL){
+            //no thread started yet
+            free(pool->threads);
+            pool->threads = NULL;
+            pool->count = i + 1;
+            task_pool_destroy(pool);
+            return "Memory allocation failed";
+        }
+    }
+    pool->thread_cpu = thread_cpu;
+    atomic_store(&pool->running, 1);
+    //deques exist for every thread before the first one can steal
+    pool->count = deques;
+    for(int i = 0; i < threads; i++){
+        pool_thread_arg_t* arg = malloc(sizeof(pool_thread_arg_t));
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        int cpu = thread_cpu != NULL ? thread_cpu() : -1;
+        if(cpu >= 0){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        int rc = arg == NULL ? -1 : 0;
+        if(rc == 0){
+            arg->pool = pool;
+            arg->index = i;
+            rc = pthread_create(&pool->threads[i], &attr, pool_thread, arg);
+        }
+        pthread_attr_destroy(&attr);
+        if(rc != 0){
+            free(arg);
+            //stop the threads already running, then give up
+            atomic_store(&pool->running, 0);
+            pthread_mutex_lock(&pool->sleep_lock);
+            pthread_cond_broadcast(&pool->wake);
+            pthread_mutex_unlock(&pool->sleep_lock);
+            for(int j = 0; j < i; j++){
+                pthread_join(pool->threads[j], NULL);
+            }
+            free(pool->threads);
+            pool->threads = NULL;
+            task_pool_destroy(pool);
+            return "Failed to create pool thread";
+        }
+    }
+    return NULL;
+}
+
+void task_pool_submit(task_pool_t* pool, void (*run)(void*), void* arg, int later){
+    task_t task = { run, arg };
+    int index;
+    if(current_pool == pool){
+        index = current_index;
+    }else{
+        index = (int)(atomic_fetch_add(&pool->next_deque, 1) % (unsigned)pool->count);
+    }
+    while(deque_push(&pool->deques[index], task, later) != 0){
+        //out of memory for a bigger deque: let the pool drain a little
+        sched_yield();
+    }
+    atomic_fetch_add(&pool->pending, 1);
+    if(atomic_load(&pool->sleepers) > 0){
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+int task_pool_run_one(task_pool_t* pool){
+    //run as the owner of the first deque: tasks this task submits go there,
+    //newest first, and later ones wait behind them
+    task_pool_t* outer_pool = current_pool;
+    int outer_index = current_index;
+    current_pool = pool;
+    current_index = 0;
+    task_t task;
+    int found = find_task(pool, 0, &task);
+    if(found){
+        atomic_fetch_sub(&pool->pending, 1);
+        task.run(task.arg);
+    }
+    current_pool = outer_pool;
+    current_index = outer_index;
+    return found;
+}
+
+void task_pool_destroy(task_pool_t* pool){
+    if(pool->deques == NULL){
+        return;
+    }
+    if(pool->threads != NULL){
+        atomic_store(&pool->running, 0);
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+        for(int i = 0; i < pool->count; i++){
+            pthread_join(pool->threads[i], NULL);
+        }
+        free(pool->threads);
+        pool->threads = NULL;
+    }
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_cond_destroy(&pool->wake);
+    for(int i = 0; i < pool->count; i++){
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    free(pool->deques);
+    pool->deques = NULL;
+    pool->count = 0;
+}
@@ -0,0 +1,75 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+/**
+ * A unit of work: run(arg) on some pool thread
+ */
+typedef struct
+{
+    void (*run)(void* arg);
+    void* arg;
+} task_t;
+/**
+ * Per-thread task deque. The owner pushes and pops at the bottom (newest
+ * first, so work it just made runs while its data is still in cache); idle
+ * threads steal from the top (oldest first)
+ */
+typedef struct
+{
+    pthread_mutex_t lock; /* Guards the deque (held for a few instructions) */
+    task_t* tasks; /* Ring of cap entries */
+    size_t cap; /* Capacity, a power of two */
+    size_t top; /* Index of the oldest task */
+    size_t bottom; /* Index one past the newest task */
+} task_deque_t;
+/**
+ * Fixed-size work-stealing thread pool
+ */
+typedef struct task_pool
+{
+    task_deque_t* deques; /* One per thread */
+    pthread_t* threads; /* Pool threads */
+    int count; /* Number of threads */
+    atomic_long pending; /* Tasks queued in all deques */
+    atomic_int sleepers; /* Threads parked waiting for a task */
+    atomic_int running; /* Cleared to stop the threads */
+    atomic_uint next_deque; /* Round-robin target for submissions from outside */
+    pthread_mutex_t sleep_lock; /* Guards parking */
+    pthread_cond_t wake; /* Signaled when a task arrives */
+    int (*thread_cpu)(void); /* CPU for each new thread (-1 = unpinned), or NULL */
+} task_pool_t;
+/**
+ * Start a pool
+ * @param pool Pointer to pool structure
+ * @param threads Number of threads; 0 starts none, and the owner runs the
+ * tasks itself with task_pool_run_one
+ * @param thread_cpu Called once per thread for the CPU to pin it to, NULL
+ * leaves the threads unpinned
+ * @return NULL on success, error message on failure
+ */
+const char* task_pool_init(task_pool_t* pool, int threads, int (*thread_cpu)(void));
+/**
+ * Queue a task. From a pool thread it goes to that thread's own deque and,
+ * unless later is set, runs next; from any other thread it goes to one of the
+ * deques in turn
+ * @param pool Pointer to pool structure
+ * @param run Task function
+ * @param arg Task argument
+ * @param later Nonzero to queue behind the work already waiting (a task that
+ * yields uses this so the tasks it is waiting for get to run first)
+ */
+void task_pool_submit(task_pool_t* pool, void (*run)(void*), void* arg, int later);
+/**
+ * Run one queued task on the calling thread. The caller acts as the owner of
+ * the first deque: its newest task runs first, tasks queued with later set
+ * run once nothing else is left
+ * @param pool Pointer to pool structure
+ * @return 1 if a task ran, 0 if none was queued
+ */
+int task_pool_run_one(task_pool_t* pool);
+/**
+ * Stop the threads once no task is running and free the pool. Tasks still
+ * queued are not run
+ * @param pool Pointer to pool structure
+ */
+void task_pool_destroy(task_pool_t* pool);
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "task_pool.h"
+
+static task_pool_t pool;
+static atomic_int ran;
+
+static void count_task(void* arg) {
+    (void)arg;
+    atomic_fetch_add(&ran, 1);
+}
+
+//wait (up to 5 s) for the counter to reach expected
+static int wait_for(atomic_int* counter, int expected) {
+    for (int i = 0; i < 5000 && atomic_load(counter) < expected; i++) {
+        usleep(1000);
+    }
+    return atomic_load(counter) == expected;
+}
+
+// test1 - every task submitted from outside the pool runs exactly once
+void run_test1_outside() {
+    printf("=== Test 1: Submissions from outside ===\n");
+    atomic_store(&ran, 0);
+    const char* err = task_pool_init(&pool, 3, NULL);
+    for (int i = 0; err == NULL && i < 10000; i++) {
+        task_pool_submit(&pool, count_task, NULL, i % 2);
+    }
+    int ok = err == NULL && wait_for(&ran, 10000);
+    printf("[Test 1] %s (%d ran)\n", ok ? "PASS: 10000 tasks ran" : "FAIL: tasks lost", atomic_load(&ran));
+    task_pool_destroy(&pool);
+    printf("=== Test 1 Complete ===\n\n");
+}
+
+static atomic_int chain;
+
+//each link queues the next one from inside the pool, like a stage waking its successor
+static void chain_task(void* arg) {
+    long left = (long)arg;
+    atomic_fetch_add(&chain, 1);
+    if (left > 1) {
+        task_pool_submit(&pool, chain_task, (void*)(left - 1), left % 3 == 0);
+    }
+}
+
+// test2 - tasks submitted by tasks run, whether queued next or later
+void run_test2_from_tasks() {
+    printf("=== Test 2: Submissions from tasks ===\n");
+    atomic_store(&chain, 0);
+    const char* err = task_pool_init(&pool, 2, NULL);
+    for (int i = 0; err == NULL && i < 4; i++) {
+        task_pool_submit(&pool, chain_task, (void*)1000L, 0);
+    }
+    int ok = err == NULL && wait_for(&chain, 4000);
+    printf("[Test 2] %s (%d ran)\n", ok ? "PASS: 4 chains of 1000" : "FAIL: chain broke", atomic_load(&chain));
+    task_pool_destroy(&pool);
+    printf("=== Test 2 Complete ===\n\n");
+}
+
+static atomic_int release;
+
+//holds its thread until released, so the tasks queued behind it must be stolen
+static void blocker_task(void* arg) {
+    (void)arg;
+    for (int i = 0; i < 5000 && !atomic_load(&release); i++) {
+        usleep(1000);
+    }
+}
+
+static void spawn_task(void* arg) {
+    (void)arg;
+    for (int i = 0; i < 100; i++) {
+        task_pool_submit(&pool, count_task, NULL, 0);
+    }
+    //everything above sits on this thread's deque behind the blocker
+    task_pool_submit(&pool, blocker_task, NULL, 0);
+    blocker_task(NULL);
+}
+
+// test3 - an idle thread steals work queued on a busy thread's deque
+void run_test3_steal() {
+    printf("=== Test 3: Stealing ===\n");
+    atomic_store(&ran, 0);
+    atomic_store(&release, 0);
+    const char* err = task_pool_init(&pool, 2, NULL);
+    if (err == NULL) {
+        task_pool_submit(&pool, spawn_task, NULL, 0);
+    }
+    int ok = err == NULL && wait_for(&ran, 100);
+    atomic_store(&release, 1);
+    printf("[Test 3] %s (%d ran while the owner was busy)\n", ok ? "PASS: queued tasks stolen" : "FAIL: no stealing", atomic_load(&ran));
+    task_pool_destroy(&pool);
+    printf("=== Test 3 Complete ===\n\n");
+}
+
+static int order[8];
+static int ordered;
+
+static void record_task(void* arg) {
+    order[ordered++] = (int)(long)arg;
+}
+
+// test4 - without threads the owner runs tasks itself: newest first, later last
+void run_test4_run_one() {
+    printf("=== Test 4: Running tasks on the owner thread ===\n");
+    ordered = 0;
+    const char* err = task_pool_init(&pool, 0, NULL);
+    if (err == NULL) {
+        task_pool_submit(&pool, record_task, (void*)1L, 0);
+        task_pool_submit(&pool, record_task, (void*)2L, 1);
+        task_pool_submit(&pool, record_task, (void*)3L, 0);
+    }
+    usleep(10000);
+    int idle = ordered == 0;
+    while (err == NULL && task_pool_run_one(&pool)) {
+    }
+    int ok = err == NULL && idle && ordered == 3 && order[0] == 3 && order[1] == 1 && order[2] == 2;
+    printf("[Test 4] %s\n", ok ? "PASS: ran 3 1 2 on the caller" : "FAIL: run order or a pool thread ran them");
+    task_pool_destroy(&pool);
+    printf("=== Test 4 Complete ===\n\n");
+}
+
+int main() {
+    run_test1_outside();
+    run_test2_from_tasks();
+    run_test3_steal();
+    run_test4_run_one();
+    return 0;
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include "trace_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+//how long the flusher sleeps between passes over the rings
+#define TRACE_FLUSH_INTERVAL_NS 2000000L
+
+static __thread trace_ring_t* thread_ring;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+//write everything ring holds; caller holds log->lock
+static void drain_ring(trace_log_t* log, trace_ring_t* ring){
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while(tail != head){
+        //up to the end of the array first, then from its start
+        size_t start = tail & (TRACE_RING_EVENTS - 1);
+        size_t count = head - tail;
+        if(count > TRACE_RING_EVENTS - start){
+            count = TRACE_RING_EVENTS - start;
+        }
+        fwrite(&ring->events[start], sizeof(trace_event_t), count, log->file);
+        tail += count;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+static void drain_all(trace_log_t* log){
+    pthread_mutex_lock(&log->lock);
+    for(trace_ring_t* ring = log->rings; ring != NULL; ring = ring->next){
+        drain_ring(log, ring);
+    }
+    fflush(log->file);
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void* flusher_thread(void* arg){
+    trace_log_t* log = arg;
+    struct timespec interval = { 0, TRACE_FLUSH_INTERVAL_NS };
+    while(atomic_load(&log->running)){
+        nanosleep(&interval, NULL);
+        drain_all(log);
+    }
+    return NULL;
+}
+
+//first event of this thread on log: give it a ring
+static trace_ring_t* ring_attach(trace_log_t* log){
+    trace_ring_t* ring = aligned_alloc(TRACE_CACHE_LINE, sizeof(trace_ring_t));
+    if(ring == NULL){
+        return NULL;
+    }
+    memset(ring, 0, sizeof(trace_ring_t));
+    ring->thread = (uint32_t)syscall(SYS_gettid);
+    ring->log = log;
+    pthread_mutex_lock(&log->lock);
+    ring->next = log->rings;
+    log->rings = ring;
+    pthread_mutex_unlock(&log->lock);
+    thread_ring = ring;
+    return ring;
+}
+
+const char* trace_log_open(trace_log_t* log, const char* path){
+    memset(log, 0, sizeof(trace_log_t));
+    log->file = fopen(path, "wb");
+    if(log->file == NULL){
+        return "Failed to create trace file";
+    }
+    char magic[8] = TRACE_FILE_MAGIC;
+    fwrite(magic, sizeof(magic), 1, log->file);
+    pthread_mutex_init(&log->lock, NULL);
+    atomic_store(&log->running, 1);
+    if(pthread_create(&log->flusher, NULL, flusher_thread, log) != 0){
+        pthread_mutex_destroy(&log->lock);
+        fclose(log->file);
+        log->file = NULL;
+        return "Failed to create trace flusher thread";
+    }
+    return NULL;
+}
+
+void trace_log_close(trace_log_t* log){
+    if(log->file == NULL){
+        return;
+    }
+    atomic_store(&log->running, 0);
+    pthread_join(log->flusher, NULL);
+    drain_all(log);
+    trace_ring_t* ring = log->rings;
+    while(ring != NULL){
+        trace_ring_t* next = ring->next;
+        if(ring->dropped > 0){
+            trace_event_t record = { now_ns(), 0, TRACE_EVENT_DROPPED, ring->thread, { ring->dropped, 0 } };
+            fwrite(&record, sizeof(record), 1, log->file);
+        }
+        if(thread_ring == ring){
+            thread_ring = NULL;
+        }
+        free(ring);
+        ring = next;
+    }
+    fclose(log->file);
+    log->file = NULL;
+    pthread_mutex_destroy(&log->lock);
+}
+
+int trace_log_source(trace_log_t* log, const char* name){
+    unsigned id = (unsigned)atomic_fetch_add(&log->sources, 1);
+    if(id >= TRACE_EVENT_DROPPED){
+        return -1;
+    }
+    //the name follows its record, padded to a whole record
+    size_t len = strlen(name);
+    size_t padded = (len + sizeof(trace_event_t) - 1) / sizeof(trace_event_t) * sizeof(trace_event_t);
+    trace_event_t record = { now_ns(), (uint16_t)id, TRACE_EVENT_SOURCE, (uint32_t)syscall(SYS_gettid), { len, 0 } };
+    char pad[sizeof(trace_event_t)] = { 0 };
+    pthread_mutex_lock(&log->lock);
+    fwrite(&record, sizeof(record), 1, log->file);
+    fwrite(name, 1, len, log->file);
+    fwrite(pad, 1, padded - len, log->file);
+    pthread_mutex_unlock(&log->lock);
+    return (int)id;
+}
+
+void trace_log_record(trace_log_t* log, int source, int event, uint64_t arg0, uint64_t arg1){
+    trace_ring_t* ring = thread_ring;
+    if(ring == NULL || ring->log != log){
+        ring = ring_attach(log);
+        if(ring == NULL){
+            return;
+        }
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(head - ring->cached_tail >= TRACE_RING_EVENTS){
+        //looks full: only now look at how far the flusher got
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if(head - ring->cached_tail >= TRACE_RING_EVENTS){
+            ring->dropped++;
+            return;
+        }
+    }
+    trace_event_t* slot = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    slot->timestamp = now_ns();
+    slot->source = (uint16_t)source;
+    slot->event = (uint16_t)event;
+    slot->thread = ring->thread;
+    slot->args[0] = arg0;
+    slot->args[1] = arg1;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
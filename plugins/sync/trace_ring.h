@@ -0,0 +1,76 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#define TRACE_CACHE_LINE 64
+#define TRACE_RING_EVENTS 16384 /* Events per thread ring, a power of two */
+#define TRACE_FILE_MAGIC "PTRACE1" /* First 8 bytes of a trace file (with the NUL) */
+#define TRACE_EVENT_SOURCE 0xffffu /* Record names a source; args[0] name bytes follow, padded to a record */
+#define TRACE_EVENT_DROPPED 0xfffeu /* Record counts events a thread ring had to drop (args[0]) */
+/**
+ * One binary event as recorded and as stored in the trace file
+ */
+typedef struct
+{
+    uint64_t timestamp; /* CLOCK_MONOTONIC, nanoseconds */
+    uint16_t source; /* Id from trace_log_source */
+    uint16_t event; /* Caller-defined event id, or TRACE_EVENT_* */
+    uint32_t thread; /* Kernel thread id of the recording thread */
+    uint64_t args[2]; /* Event arguments */
+} trace_event_t;
+/**
+ * Single-producer ring of one thread; the flusher is its only consumer
+ */
+typedef struct trace_ring
+{
+    trace_event_t events[TRACE_RING_EVENTS];
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t head; /* Next slot the owner writes */
+    size_t cached_tail; /* Owner's last view of tail, saves reading the flusher's line */
+    size_t dropped; /* Events lost because the ring was full (owner only) */
+    uint32_t thread; /* Kernel thread id of the owner */
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t tail; /* Next slot the flusher reads */
+    struct trace_log* log; /* Log this ring belongs to */
+    struct trace_ring* next; /* All rings of a log */
+} trace_ring_t;
+/**
+ * Binary trace log: per-thread rings drained to a file by a background thread
+ */
+typedef struct trace_log
+{
+    FILE* file; /* Trace file */
+    pthread_mutex_t lock; /* Guards the ring list and writes to file */
+    trace_ring_t* rings; /* Every ring created so far */
+    atomic_int sources; /* Number of sources registered */
+    atomic_int running; /* Cleared to stop the flusher */
+    pthread_t flusher; /* Background thread writing the rings out */
+} trace_log_t;
+/**
+ * Create the trace file and start the flusher thread
+ * @param log Pointer to log structure
+ * @param path File to write
+ * @return NULL on success, error message on failure
+ */
+const char* trace_log_open(trace_log_t* log, const char* path);
+/**
+ * Stop the flusher, write out every ring and close the file. Call after the
+ * recording threads are done
+ * @param log Pointer to log structure
+ */
+void trace_log_close(trace_log_t* log);
+/**
+ * Register an event source (e.g. a stage) and write its name to the file
+ * @param log Pointer to log structure
+ * @param name Source name
+ * @return Source id, or -1 when no more sources fit
+ */
+int trace_log_source(trace_log_t* log, const char* name);
+/**
+ * Record an event on the calling thread's ring. Never blocks: when the ring
+ * is full the event is counted as dropped instead
+ * @param log Pointer to log structure
+ * @param source Id from trace_log_source
+ * @param event Event id
+ * @param arg0 First argument
+ * @param arg1 Second argument
+ */
+void trace_log_record(trace_log_t* log, int source, int event, uint64_t arg0, uint64_t arg1);
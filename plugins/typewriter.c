@@ -15,8 +15,21 @@ const char* plugin_transform(const char* input) {
     }
     printf("\n");
     fflush(stdout);
-    char* result = strdup(input);
-    return result;
+    //pass-through: hand the same buffer on, no copy
+    return input;
+}
+
+__attribute__((visibility("default")))
+message_t* plugin_transform_v2(message_t* input) {
+    printf("%s","[typewriter] ");
+    for (size_t i = 0; i < input->len; i++) {
+        putchar(input->data[i]);
+        fflush(stdout);
+        usleep(100000);
+    }
+    printf("\n");
+    fflush(stdout);
+    return input;
 }
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size) {
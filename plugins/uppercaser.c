@@ -4,17 +4,33 @@
 #include <stdlib.h>
 
 const char* plugin_transform(const char* input){
-    char* result = malloc(strlen(input)+1);
     if(input == NULL){
         return NULL;
     }
-    for (int i = 0; i < strlen(input); i++) {
+    size_t len = strlen(input);
+    char* result = plugin_alloc(len+1);
+    if(result == NULL){
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i++) {
         result[i] = toupper((unsigned char)input[i]);
     }
-    result[strlen(input)] ='\0';
+    result[len] ='\0';
     return result;
 }
 
+__attribute__((visibility("default")))
+void plugin_transform_inplace(char* buf, size_t len){
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = toupper((unsigned char)buf[i]);
+    }
+}
+
 const char* plugin_init(int queue_size) {
     return common_plugin_init(plugin_transform, "uppercaser", queue_size);
+}
+
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void){
+    return PLUGIN_CAP_STATELESS | PLUGIN_CAP_FUSABLE | PLUGIN_CAP_NONBLOCKING;
 }
\ No newline at end of file
@@ -311,6 +311,385 @@ else
 fi
 
 
+# 23) byte budget smaller than a line still moves every line, in order
+EXPECTED=$(for i in $(seq 1 100); do echo "[logger] $i" | sed 's/\([0-9]*\)\([0-9]\)$/\2\1/'; done)
+ACTUAL=$( { seq 1 100; echo "<END>"; } | ./output/analyzer --queue-bytes=2 10 uppercaser rotator logger | grep "^\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+  print_status "--queue-bytes smaller than a line keeps all lines in order"
+else
+  print_error "--queue-bytes (Expected 1..100 in order, got '$ACTUAL')"
+  exit 1
+fi
+
+# 24) invalid byte budget: not a number, negative, or too big for size_t
+set +e
+OUTPUT=$(./output/analyzer --queue-bytes=abc 10 logger 2>&1)
+RC=$?
+ACCEPTED=""
+for BUDGET in -1 " 5" 18446744073709551616 17179869184G; do
+  printf "<END>\n" | ./output/analyzer --queue-bytes="$BUDGET" 10 logger >/dev/null 2>&1 && ACCEPTED="$ACCEPTED '$BUDGET'"
+done
+set -e
+if [ $RC -ne 0 ] && echo "$OUTPUT" | grep -q "Usage" && [ -z "$ACCEPTED" ]; then
+  print_status "invalid --queue-bytes → usage printed, exit non-zero"
+else
+  print_error "invalid --queue-bytes should fail but returned $RC (accepted:$ACCEPTED)"
+  exit 1
+fi
+
+# 25) long chain: one loaded .so serves every stage, well past the namespace limit
+CHAIN=$(for i in $(seq 1 63); do printf "rotator "; done)
+EXPECTED="[logger] abc"
+ACTUAL=$(printf "abc\n<END>\n" | ./output/analyzer 10 $CHAIN logger | grep "^\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+  print_status "63 rotator instances from one plugin load"
+else
+  print_error "long chain (Expected '$EXPECTED', got '$ACTUAL')"
+  exit 1
+fi
+
+# 26) --isolate keeps the one-namespace-per-stage loading path
+EXPECTED="[logger] OHELL"
+ACTUAL=$(printf "hello\n<END>\n" | ./output/analyzer --isolate 10 uppercaser rotator logger | grep "^\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+  print_status "--isolate loads each stage into its own namespace"
+else
+  print_error "--isolate (Expected '$EXPECTED', got '$ACTUAL')"
+  exit 1
+fi
+
+# 27) replicated stages keep input order; stateful stages stay single-threaded
+EXPECTED=$( { seq 1 2000; echo "<END>"; } | ./output/analyzer 10 expander rotator logger)
+ACTUAL=$( { seq 1 2000; echo "<END>"; } | ./output/analyzer 10 expander:4 rotator:3 logger:2 2>/tmp/pool_err.txt)
+if [ "$ACTUAL" == "$EXPECTED" ] && grep -q "logger cannot run replicated" /tmp/pool_err.txt; then
+  print_status "expander:4 rotator:3 keep order, logger:2 falls back to one worker"
+else
+  print_error "worker pools (output differs from single-threaded run or no fallback notice)"
+  exit 1
+fi
+rm -f /tmp/pool_err.txt
+
+# 28) fused stateless stages give the same output as separate stages
+EXPECTED=$( { seq 1 500; echo "<END>"; } | ./output/analyzer --no-fusion 10 uppercaser rotator flipper expander logger)
+ACTUAL=$( { seq 1 500; echo "<END>"; } | ./output/analyzer 10 uppercaser rotator flipper expander logger)
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+  print_status "fused uppercaser→rotator→flipper→expander matches --no-fusion"
+else
+  print_error "stage fusion changed the output"
+  exit 1
+fi
+
+# 29) messages carry their length: NUL bytes survive, long lines are not split
+EXPECTED=$(printf '[logger] C A \0 B\n' | od -c)
+ACTUAL=$(printf 'a\0bc\n<END>\n' | ./output/analyzer 10 uppercaser rotator expander logger | grep -a "^\[logger\]" | od -c)
+LONG=$(head -c 100000 /dev/zero | tr '\0' 'x')
+LONG_LINES=$( { echo "$LONG"; echo "<END>"; } | ./output/analyzer 10 uppercaser logger | awk '/^\[logger\] X*$/ { print length($0) }')
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$LONG_LINES" == "100009" ]; then
+  print_status "NUL bytes and a 100000-byte line pass through intact"
+else
+  print_error "message payloads (NUL bytes or long line altered)"
+  exit 1
+fi
+
+# 30) end of stream is a control message: data that reads "<END>" flows on
+EXPECTED=$(printf '[logger] <END>\n[logger] retfa')
+ACTUAL=$(printf ">DNE<\nafter\n<END>\n" | ./output/analyzer 10 flipper logger | grep "^\[logger\]")
+POOLED=$(printf ">DNE<\nafter\n<END>\n" | ./output/analyzer 10 flipper:2 logger | grep "^\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$POOLED" == "$EXPECTED" ]; then
+  print_status "a transform producing <END> does not end the stream"
+else
+  print_error "control messages (Expected '$EXPECTED', got '$ACTUAL' / '$POOLED')"
+  exit 1
+fi
+
+# 31) log levels: debug logs go to stderr untruncated, the default prints none
+LONG=$(head -c 1000 /dev/zero | tr '\0' 'y')
+DEBUG_LINES=$( { echo "$LONG"; echo "<END>"; } | ANALYZER_LOG_LEVEL=debug ./output/analyzer 10 logger 2>&1 >/dev/null | grep -c "got item: $LONG")
+QUIET=$( { echo "$LONG"; echo "<END>"; } | ./output/analyzer 10 logger 2>&1 >/dev/null | wc -l)
+if [ "$DEBUG_LINES" == "1" ] && [ "$QUIET" == "0" ]; then
+  print_status "ANALYZER_LOG_LEVEL=debug logs whole items, default level stays quiet"
+else
+  print_error "log levels (debug lines '$DEBUG_LINES', default stderr lines '$QUIET')"
+  exit 1
+fi
+
+# 32) --trace records binary events that trace_decode renders as log lines
+rm -f /tmp/analyzer_test.trc
+printf "hello\nab\n<END>\n" | ./output/analyzer --trace=/tmp/analyzer_test.trc 10 uppercaser logger >/dev/null
+DECODED=$(./output/trace_decode /tmp/analyzer_test.trc)
+if echo "$DECODED" | grep -q "^\[INFO\]\[uppercaser\] - Plugin initialized successfully$" \
+   && [ "$(echo "$DECODED" | grep -c "^\[DEBUG\]\[logger\] - got item")" == "2" ] \
+   && echo "$DECODED" | grep -q "^\[DEBUG\]\[uppercaser\] - got item (5 bytes)$"; then
+  print_status "--trace output decodes to per-stage log lines"
+else
+  print_error "binary trace (decoded: $DECODED)"
+  exit 1
+fi
+rm -f /tmp/analyzer_test.trc
+
+# 33) --cpus pins threads without changing output; a bad CPU list is refused
+EXPECTED="[logger] OHELL"
+ACTUAL=$(printf "hello\n<END>\n" | ./output/analyzer --cpus=auto 10 uppercaser rotator:2 logger | grep "^\[logger\]")
+ENV_ACTUAL=$(printf "hello\n<END>\n" | ANALYZER_CPUS=auto ./output/analyzer 10 uppercaser rotator logger | grep "^\[logger\]")
+set +e
+./output/analyzer --cpus=3-1 10 logger </dev/null >/dev/null 2>&1
+RC=$?
+set -e
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$ENV_ACTUAL" == "$EXPECTED" ] && [ $RC -ne 0 ]; then
+  print_status "--cpus=auto and ANALYZER_CPUS place threads, 3-1 is rejected"
+else
+  print_error "thread placement (got '$ACTUAL' / '$ENV_ACTUAL', rc $RC)"
+  exit 1
+fi
+
+# 34) --tasks runs nonblocking stages on a small pool; a sleeping stage keeps its thread
+CHAIN=$(for i in $(seq 1 15); do printf "uppercaser rotator "; done)
+EXPECTED=$( { seq 1 3000; echo "<END>"; } | ./output/analyzer --no-fusion 4 $CHAIN logger)
+ACTUAL=$( { seq 1 3000; echo "<END>"; } | ./output/analyzer --tasks=2 --no-fusion 4 $CHAIN logger)
+{ sleep 0.5; printf "a\n<END>\n"; } | ./output/analyzer --tasks=2 --no-fusion 4 $CHAIN logger >/dev/null &
+sleep 0.2
+THREADS=$(ls /proc/$(pgrep -n -x analyzer)/task | wc -l)
+wait
+MIXED=$(printf "ab\n<END>\n" | ./output/analyzer --tasks 4 uppercaser typewriter logger | grep "^\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$THREADS" == "3" ] && [ "$MIXED" == "[logger] AB" ]; then
+  print_status "31 stages on 2 task threads match the thread-per-stage run"
+else
+  print_error "task mode (output differs, $THREADS threads, mixed '$MIXED')"
+  exit 1
+fi
+
+# 35) --single-thread runs every stage on the reader thread, queue semantics unchanged
+EXPECTED=$( { seq 1 3000; echo "<END>"; } | ./output/analyzer 2 uppercaser rotator flipper expander logger)
+ACTUAL=$( { seq 1 3000; echo "<END>"; } | ./output/analyzer --single-thread --no-fusion 2 uppercaser rotator flipper expander logger)
+TYPED=$(printf "ab\ncd\n<END>\n" | ./output/analyzer --single-thread 1 uppercaser typewriter logger | grep -c "^\[logger\] [A-Z][A-Z]$")
+{ sleep 0.5; printf "a\n<END>\n"; } | ./output/analyzer --single-thread --no-fusion 2 uppercaser rotator logger >/dev/null &
+sleep 0.2
+THREADS=$(ls /proc/$(pgrep -n -x analyzer)/task | wc -l)
+wait
+set +e
+./output/analyzer --isolate --single-thread 10 logger </dev/null >/dev/null 2>&1
+RC=$?
+set -e
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$TYPED" == "2" ] && [ "$THREADS" == "1" ] && [ $RC -ne 0 ]; then
+  print_status "single-threaded pipeline matches the threaded one on one thread"
+else
+  print_error "single-thread mode (output differs, $THREADS threads, --isolate rc $RC)"
+  exit 1
+fi
+
+# 36) --stats prints a per-stage table at exit and on SIGUSR1; output is unchanged
+EXPECTED=$( { seq 1 1000; echo "<END>"; } | ./output/analyzer --no-fusion 10 uppercaser expander logger)
+ACTUAL=$( { seq 1 1000; echo "<END>"; } | ./output/analyzer --stats --no-fusion 10 uppercaser expander logger 2>/tmp/stats_err.txt)
+ROWS=$(grep -cE "^(uppercaser|expender|logger) +1000 +1000 " /tmp/stats_err.txt || true)
+{ echo "early"; sleep 1; echo "<END>"; } | ./output/analyzer --stats 10 uppercaser logger >/dev/null 2>/tmp/stats_live.txt &
+sleep 0.5
+kill -USR1 "$(pgrep -n -x analyzer)"
+wait
+LIVE=$(grep -c "^Stage statistics" /tmp/stats_live.txt)
+CPU_ROWS=$(sed -n '/^Stage CPU/,$p' /tmp/stats_err.txt | grep -cE "^(uppercaser|expender|logger) +[0-9.]+ +[0-9.]+% +[0-9]+ " || true)
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$ROWS" == "3" ] && [ "$LIVE" == "2" ] && [ "$CPU_ROWS" == "3" ]; then
+  print_status "--stats table counts every stage, SIGUSR1 dumps it while running, CPU per item at exit"
+else
+  print_error "stage statistics ($ROWS rows of 1000 items, $LIVE tables with SIGUSR1, $CPU_ROWS CPU rows)"
+  exit 1
+fi
+rm -f /tmp/stats_err.txt /tmp/stats_live.txt
+
+# 37) trace_decode -c turns a trace into a Chrome timeline: spans per stage, arrows between stages
+{ seq 1 5; echo "<END>"; } | ./output/analyzer --no-fusion --trace=/tmp/analyzer_test.trc 10 uppercaser flipper logger >/dev/null
+./output/trace_decode -c /tmp/analyzer_test.trc > /tmp/analyzer_test.json
+TRANSFORMS=$(grep -c '"ph":"X","name":"transform"' /tmp/analyzer_test.json || true)
+FORWARDS=$(grep -c '"ph":"X","name":"forward"' /tmp/analyzer_test.json || true)
+STARTS=$(grep -c '"ph":"s","name":"queue"' /tmp/analyzer_test.json || true)
+ENDS=$(grep -c '"ph":"f","name":"queue"' /tmp/analyzer_test.json || true)
+TRACKS=$(grep -c '"name":"thread_name"' /tmp/analyzer_test.json || true)
+CLOSED=$(tail -n 1 /tmp/analyzer_test.json)
+if [ "$TRANSFORMS" == "15" ] && [ "$FORWARDS" == "10" ] && [ "$STARTS" == "10" ] && [ "$ENDS" == "10" ] && [ "$TRACKS" -ge 3 ] && [ "$CLOSED" == "]}" ]; then
+  print_status "trace_decode -c exports transform/forward spans and flows"
+else
+  print_error "Chrome trace export ($TRANSFORMS transforms, $FORWARDS forwards, $STARTS/$ENDS flows, $TRACKS tracks)"
+  exit 1
+fi
+rm -f /tmp/analyzer_test.trc /tmp/analyzer_test.json
+
+# 38) --metrics serves a JSON snapshot on a Unix socket while the pipeline runs
+if command -v python3 >/dev/null 2>&1; then
+  EXPECTED=$( { seq 1 1000; echo "<END>"; } | ./output/analyzer 10 uppercaser logger)
+  ACTUAL=$( { seq 1 1000; echo "<END>"; } | ./output/analyzer --metrics=/tmp/analyzer_test.sock 10 uppercaser logger)
+  LEFT=$(ls /tmp/analyzer_test.sock 2>/dev/null || true)
+  { seq 1 30; echo "<END>"; } | ./output/analyzer --metrics=/tmp/analyzer_test.sock 2 uppercaser typewriter logger >/dev/null &
+  sleep 1
+  SNAPSHOT=$(python3 -c '
+import json, socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+data = b""
+while True:
+    chunk = s.recv(4096)
+    if not chunk:
+        break
+    data += chunk
+m = json.loads(data)
+print(m["reader"], " ".join("%s:%d/%d:%s" % (st["name"], st["queue_depth"], st["queue_capacity"], st["state"].replace(" ", "_")) for st in m["stages"]))
+' /tmp/analyzer_test.sock)
+  kill "$(pgrep -n -x analyzer)"
+  wait || true
+  rm -f /tmp/analyzer_test.sock
+  # typewriter takes far longer per line than uppercaser, so uppercaser and the reader back up behind it
+  if [ "$ACTUAL" == "$EXPECTED" ] && [ -z "$LEFT" ] && [[ "$SNAPSHOT" == "blocked on full uppercaser:2/2:blocked_on_full typewriter:"* ]]; then
+    print_status "--metrics reports queue depths and the stage blocked on a full queue"
+  else
+    print_error "metrics socket (snapshot '$SNAPSHOT', socket left '$LEFT')"
+    exit 1
+  fi
+else
+  echo "⚠ python3 not found; skipping metrics socket test"
+fi
+
+# 39) plugins carry USDT probe notes, each on a nop, for bpftrace/perf to attach to
+if command -v readelf >/dev/null 2>&1 && command -v objdump >/dev/null 2>&1; then
+  PROBES=$(readelf -n output/uppercaser.so | sed -n 's/^ *Name: //p' | sort -u | tr '\n' ' ')
+  NOPS=0
+  for LOCATION in $(readelf -n output/uppercaser.so | sed -n 's/^ *Location: \(0x[0-9a-f]*\),.*/\1/p'); do
+    if objdump -d --start-address=$LOCATION --stop-address=$((LOCATION + 1)) output/uppercaser.so | tail -n 1 | grep -q "nop"; then
+      NOPS=$((NOPS + 1))
+    fi
+  done
+  SITES=$(readelf -n output/uppercaser.so | grep -c "Provider: analyzer" || true)
+  if [ "$PROBES" == "monitor_block monitor_signal monitor_wake queue_get queue_put transform_end transform_start " ] && [ "$NOPS" == "$SITES" ]; then
+    print_status "USDT probes queue_put/get, monitor_block/wake/signal, transform_start/end on nops"
+  else
+    print_error "USDT probes (names '$PROBES', $NOPS of $SITES on a nop)"
+    exit 1
+  fi
+else
+  echo "⚠ readelf/objdump not found; skipping USDT probe test"
+fi
+
+# 40) logger batches its writes but still shows a line once the input runs dry
+{ echo "first"; sleep 1; echo "second"; echo "<END>"; } | ./output/analyzer 10 uppercaser logger > /tmp/analyzer_test.out &
+sleep 0.5
+EARLY=$(cat /tmp/analyzer_test.out)
+wait
+FINAL=$(cat /tmp/analyzer_test.out)
+rm -f /tmp/analyzer_test.out
+BIG_EXPECTED=$(seq 1 20000 | sed 's/^/[logger] /')
+BIG_ACTUAL=$( { seq 1 20000; echo "<END>"; } | ./output/analyzer 10 logger | grep -v "^Pipeline shutdown complete")
+if [ "$EARLY" == "[logger] FIRST" ] && [ "$FINAL" == "$(printf '[logger] FIRST\n[logger] SECOND\nPipeline shutdown complete')" ] && [ "$BIG_ACTUAL" == "$BIG_EXPECTED" ]; then
+  print_status "logger output is batched, flushed when idle, whole and in order"
+else
+  print_error "buffered logger output (early '$EARLY')"
+  exit 1
+fi
+
+# 41) unit tests of plugins/sync, built by build.sh into output/tests
+for TEST in output/tests/*_test; do
+  set +e
+  OUT=$(timeout 120 "$TEST" 2>&1)
+  RC=$?
+  set -e
+  if [ $RC -ne 0 ] || grep -q "FAIL" <<< "$OUT"; then
+    print_error "$(basename "$TEST") (exit $RC)"
+    grep "FAIL" <<< "$OUT" || true
+    exit 1
+  fi
+done
+print_status "unit tests in plugins/sync pass ($(ls output/tests/*_test | wc -l) binaries)"
+
+# 42) fusion skips a stateful plugin behind a worker pool, and any plugin with control hooks
+build_counter_so() {
+  gcc -g -O0 -fPIC -shared -o output/$1.so -x c - -x none \
+      plugins/plugin_common.c plugins/sync/consumer_producer.c plugins/sync/spsc_ring.c plugins/sync/mpmc_ring.c \
+      plugins/sync/monitor.c plugins/sync/message.c plugins/sync/stage_stats.c \
+      -Iplugins -Iplugins/sync -lpthread ${2:-} <<'EOF'
+#include "plugin_common.h"
+#include <stdio.h>
+#include <string.h>
+static unsigned long count;
+const char* plugin_transform(const char* input){
+    char* result = plugin_alloc(strlen(input) + 24);
+    if(result != NULL){
+        sprintf(result, "%lu %s", ++count, input);
+    }
+    return result;
+}
+#ifdef WITH_HOOKS
+__attribute__((visibility("default")))
+void plugin_control(message_kind_t kind){
+    if(kind == MESSAGE_END){
+        printf("[counter] %lu items\n", count);
+    }
+}
+#endif
+__attribute__((visibility("default")))
+const char* plugin_init(int queue_size){
+    return common_plugin_init(plugin_transform, "counter", queue_size);
+}
+__attribute__((visibility("default")))
+unsigned plugin_get_capabilities(void){
+    return PLUGIN_CAP_FUSABLE | PLUGIN_CAP_NONBLOCKING;
+}
+EOF
+}
+stage_threads() {
+  { sleep 0.5; printf "a\n<END>\n"; } | ./output/analyzer "$@" >/dev/null &
+  sleep 0.2
+  ls /proc/$(pgrep -n -x analyzer)/task | wc -l
+  wait
+}
+build_counter_so counter
+build_counter_so counter_hooks -DWITH_HOOKS
+FUSED=$(stage_threads 10 uppercaser counter logger)
+SEPARATE=$(stage_threads --no-fusion 10 uppercaser counter logger)
+POOL=$(stage_threads 10 uppercaser:2 counter logger)
+POOL_SEPARATE=$(stage_threads --no-fusion 10 uppercaser:2 counter logger)
+HOOKS=$(stage_threads 10 uppercaser counter_hooks logger)
+NUMBERED=$( { seq 1 2000; echo "<END>"; } | ./output/analyzer 10 uppercaser:4 counter logger | grep -c '^\[logger\] \([0-9]*\) \1$' || true)
+REPORTED=$( { seq 1 5; echo "<END>"; } | ./output/analyzer 10 uppercaser counter_hooks logger | grep "^\[counter\]" || true)
+rm -f output/counter.so output/counter_hooks.so
+if [ "$FUSED" -lt "$SEPARATE" ] && [ "$POOL" == "$POOL_SEPARATE" ] && [ "$HOOKS" == "$SEPARATE" ] && [ "$NUMBERED" == "2000" ] && [ "$REPORTED" == "[counter] 5 items" ]; then
+  print_status "stateful stage is not fused behind uppercaser:2, hooked stage keeps its plugin_control"
+else
+  print_error "fusion limits (threads fused $FUSED/$SEPARATE, pool $POOL/$POOL_SEPARATE, hooks $HOOKS, numbered $NUMBERED, '$REPORTED')"
+  exit 1
+fi
+
+# 43) a task stage behind a full, slow thread-owned stage parks instead of polling
+CPU=$( { TIMEFORMAT='%R %U %S'; time ./output/analyzer --tasks=1 1 uppercaser typewriter logger < <(seq 1 8; echo "<END>") >/dev/null 2>&1; } 2>&1 )
+if awk -v t="$CPU" 'BEGIN { split(t, v, " "); exit !(v[2] + v[3] < 0.1) }'; then
+  print_status "task stage behind typewriter stays idle while it waits (wall/user/sys: $CPU)"
+else
+  print_error "task stage behind typewriter burns CPU (wall/user/sys: $CPU)"
+  exit 1
+fi
+
+# 44) trace_decode keeps events with the same timestamp in file order
+if command -v python3 >/dev/null 2>&1; then
+  python3 -c '
+import struct, sys
+out = open(sys.argv[1], "wb")
+out.write(b"PTRACE1\0")
+out.write(struct.pack("<QHHI2Q", 1, 0, 0xffff, 7, 5, 0) + b"stage".ljust(32, b"\0"))
+for i in range(200):
+    # PLUGIN_TRACE_CONTROL, all on one clock tick, between PLUGIN_TRACE_INIT
+    # events from earlier ticks that the sort has to move in front of them
+    out.write(struct.pack("<QHHI2Q", 1000, 0, 5, 7, i, 0))
+    if i % 3 == 0:
+        out.write(struct.pack("<QHHI2Q", 999 - i, 0, 0, 7, 0, 0))
+' /tmp/analyzer_test.trc
+  ORDER=$(./output/trace_decode /tmp/analyzer_test.trc | sed -n 's/.*got control message //p' | tr '\n' ' ')
+  rm -f /tmp/analyzer_test.trc
+  if [ "$ORDER" == "$(seq 0 199 | tr '\n' ' ')" ]; then
+    print_status "trace_decode keeps same-timestamp events in file order"
+  else
+    print_error "trace_decode reordered same-timestamp events"
+    exit 1
+  fi
+else
+  echo "⚠ python3 not found; skipping trace tie-order test"
+fi
+
+
 require_valgrind() {
   if ! command -v valgrind >/dev/null 2>&1; then
     echo "⚠ valgrind not found; skipping valgrind tests"
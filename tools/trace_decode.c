@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin_host.h"
+#include "trace_ring.h"
+
+// How each PLUGIN_TRACE_* event is rendered; %llu takes args[0]
+typedef struct
+{
+    const char* level;
+    const char* format;
+} event_text_t;
+
+static const event_text_t event_texts[PLUGIN_TRACE_EVENT_COUNT] = {
+    [PLUGIN_TRACE_INIT] = { "INFO", "Plugin initialized successfully" },
+    [PLUGIN_TRACE_ITEM] = { "DEBUG", "got item (%llu bytes)" },
+    [PLUGIN_TRACE_RESULT] = { "DEBUG", "transformed result (%llu bytes)" },
+    [PLUGIN_TRACE_FORWARD] = { "DEBUG", "forwarding" },
+    [PLUGIN_TRACE_LAST_STAGE] = { "DEBUG", "no next plugin — freeing output" },
+    [PLUGIN_TRACE_CONTROL] = { "DEBUG", "got control message %llu" },
+    [PLUGIN_TRACE_DROP] = { "ERROR", "transform failed, dropping item" },
+    [PLUGIN_TRACE_FINISHED] = { "INFO", "plugin thread finished" },
+    [PLUGIN_TRACE_FORWARDED] = { "DEBUG", "forwarded" },
+};
+
+// A span that has begun and not yet ended, keyed by thread and stage
+typedef struct
+{
+    uint32_t thread;
+    uint16_t source;
+    uint64_t start; /* Timestamp of the opening event, 0 when nothing is open */
+} open_span_t;
+
+// Threads seen in a trace and the stages that ran on them, for track names
+typedef struct
+{
+    uint32_t thread;
+    char label[256];
+} track_t;
+
+// An event as read, with its place in the file
+typedef struct
+{
+    trace_event_t event;
+    size_t index; /* Events before it in the file */
+} read_event_t;
+
+// Events of different threads reach the file in flush order, not time order
+static int compare_events(const void* a, const void* b){
+    const read_event_t* x = a;
+    const read_event_t* y = b;
+    if(x->event.timestamp != y->event.timestamp){
+        return x->event.timestamp < y->event.timestamp ? -1 : 1;
+    }
+    //same clock tick: keep file order (qsort is not stable)
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void usage(void){
+    printf("Usage: ./trace_decode [-t | -c] <trace_file>\n");
+    printf("  Print a trace recorded with analyzer --trace=FILE as log lines\n");
+    printf("  -t    Prefix each line with microseconds since the first event and the thread id\n");
+    printf("  -c    Print Chrome trace-event JSON instead (open in Perfetto or chrome://tracing):\n");
+    printf("        transform and forward spans on one track per thread, arrows from each\n");
+    printf("        forward to the dequeue in the next stage\n");
+}
+
+// Stage names are plugin names, but keep the JSON valid whatever they hold
+static void print_json_string(const char* text){
+    putchar('"');
+    for(const unsigned char* p = (const unsigned char*)text; *p != '\0'; p++){
+        if(*p == '"' || *p == '\\'){
+            printf("\\%c", *p);
+        }else if(*p < 0x20){
+            printf("\\u%04x", *p);
+        }else{
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+// Find (or add) the open span of a thread and stage
+static open_span_t* span_of(open_span_t** spans, size_t* count, uint32_t thread, uint16_t source){
+    for(size_t i = 0; i < *count; i++){
+        if((*spans)[i].thread == thread && (*spans)[i].source == source){
+            return &(*spans)[i];
+        }
+    }
+    open_span_t* grown = realloc(*spans, (*count + 1) * sizeof(open_span_t));
+    if(grown == NULL){
+        return NULL;
+    }
+    *spans = grown;
+    open_span_t* span = &grown[(*count)++];
+    span->thread = thread;
+    span->source = source;
+    span->start = 0;
+    return span;
+}
+
+// Label a thread's track with every stage that ran on it (task threads run several)
+static void track_add(track_t** tracks, size_t* count, uint32_t thread, const char* name){
+    track_t* track = NULL;
+    for(size_t i = 0; i < *count; i++){
+        if((*tracks)[i].thread == thread){
+            track = &(*tracks)[i];
+        }
+    }
+    if(track == NULL){
+        track_t* grown = realloc(*tracks, (*count + 1) * sizeof(track_t));
+        if(grown == NULL){
+            return;
+        }
+        *tracks = grown;
+        track = &grown[(*count)++];
+        track->thread = thread;
+        track->label[0] = '\0';
+    }
+    size_t len = strlen(track->label);
+    size_t nameLen = strlen(name);
+    //whole words only: "uppercaser" must not match inside another name
+    for(const char* p = strstr(track->label, name); p != NULL; p = strstr(p + 1, name)){
+        if((p == track->label || p[-1] == ' ') && (p[nameLen] == '\0' || p[nameLen] == ' ')){
+            return;
+        }
+    }
+    if(len + nameLen + 2 < sizeof(track->label)){
+        snprintf(track->label + len, sizeof(track->label) - len, "%s%s", len > 0 ? " " : "", name);
+    }
+}
+
+// Messages forwarded and not yet taken by the next stage; the first stage's
+// items come from the reader and have no forward to draw an arrow from
+static int flow_add(uint64_t** flows, size_t* count, uint64_t id){
+    uint64_t* grown = realloc(*flows, (*count + 1) * sizeof(uint64_t));
+    if(grown == NULL){
+        return 0;
+    }
+    *flows = grown;
+    grown[(*count)++] = id;
+    return 1;
+}
+
+static int flow_take(uint64_t* flows, size_t* count, uint64_t id){
+    for(size_t i = 0; i < *count; i++){
+        if(flows[i] == id){
+            flows[i] = flows[--(*count)];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One trace event; ts and dur in microseconds since the first event
+static void print_chrome_event(int* first, const char* ph, const char* name, const char* stage, uint32_t thread, uint64_t ts, uint64_t origin){
+    printf("%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"cat\":", *first ? "" : ",", ph, name);
+    print_json_string(stage);
+    printf(",\"pid\":1,\"tid\":%u,\"ts\":%.3f", thread, (ts - origin) / 1000.0);
+    *first = 0;
+}
+
+// Chrome trace-event JSON: X spans for transform (ITEM..RESULT/DROP) and
+// forward (FORWARD..FORWARDED), a flow arrow from each forward to the
+// dequeue of the same message in the next stage, instants for the rest
+static void print_chrome(const trace_event_t* events, size_t count, char** names, size_t nameCount){
+    static const char* controls[] = { "data", "END", "FLUSH", "STATS" };
+    open_span_t* transforms = NULL;
+    size_t transformCount = 0;
+    open_span_t* forwards = NULL;
+    size_t forwardCount = 0;
+    track_t* tracks = NULL;
+    size_t trackCount = 0;
+    uint64_t* flows = NULL;
+    size_t flowCount = 0;
+    uint64_t origin = count > 0 ? events[0].timestamp : 0;
+    int first = 1;
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for(size_t i = 0; i < count; i++){
+        const trace_event_t* ev = &events[i];
+        const char* name = ev->source < nameCount && names[ev->source] != NULL ? names[ev->source] : "?";
+        track_add(&tracks, &trackCount, ev->thread, name);
+        open_span_t* span;
+        switch(ev->event){
+        case PLUGIN_TRACE_ITEM:
+            print_chrome_event(&first, "i", "dequeue", name, ev->thread, ev->timestamp, origin);
+            printf(",\"s\":\"t\",\"args\":{\"bytes\":%llu}}", (unsigned long long)ev->args[0]);
+            if(ev->args[1] != 0 && flow_take(flows, &flowCount, ev->args[1])){
+                print_chrome_event(&first, "f", "queue", name, ev->thread, ev->timestamp, origin);
+                printf(",\"bp\":\"e\",\"id\":\"0x%llx\"}", (unsigned long long)ev->args[1]);
+            }
+            span = span_of(&transforms, &transformCount, ev->thread, ev->source);
+            if(span != NULL){
+                span->start = ev->timestamp;
+            }
+            break;
+        case PLUGIN_TRACE_RESULT:
+        case PLUGIN_TRACE_DROP:
+            span = span_of(&transforms, &transformCount, ev->thread, ev->source);
+            if(span != NULL && span->start != 0){
+                print_chrome_event(&first, "X", "transform", name, ev->thread, span->start, origin);
+                printf(",\"dur\":%.3f,\"args\":{\"bytes\":%llu%s}}", (ev->timestamp - span->start) / 1000.0,
+                       (unsigned long long)ev->args[0], ev->event == PLUGIN_TRACE_DROP ? ",\"dropped\":true" : "");
+                span->start = 0;
+            }
+            break;
+        case PLUGIN_TRACE_FORWARD:
+            //a task stage may finish its forward on another pool thread, so
+            //forwards are keyed by stage alone and drawn where they began
+            span = span_of(&forwards, &forwardCount, 0, ev->source);
+            if(span != NULL){
+                span->start = ev->timestamp;
+                span->thread = ev->thread;
+            }
+            if(ev->args[1] != 0 && flow_add(&flows, &flowCount, ev->args[1])){
+                print_chrome_event(&first, "s", "queue", name, ev->thread, ev->timestamp, origin);
+                printf(",\"id\":\"0x%llx\"}", (unsigned long long)ev->args[1]);
+            }
+            break;
+        case PLUGIN_TRACE_FORWARDED:
+            for(size_t j = 0; j < forwardCount; j++){
+                span = &forwards[j];
+                if(span->source == ev->source && span->start != 0){
+                    print_chrome_event(&first, "X", "forward", name, span->thread, span->start, origin);
+                    printf(",\"dur\":%.3f}", (ev->timestamp - span->start) / 1000.0);
+                    span->start = 0;
+                }
+            }
+            break;
+        case PLUGIN_TRACE_CONTROL:
+            print_chrome_event(&first, "i", ev->args[0] < 4 ? controls[ev->args[0]] : "control", name, ev->thread, ev->timestamp, origin);
+            printf(",\"s\":\"t\"}");
+            break;
+        case PLUGIN_TRACE_LAST_STAGE:
+            break;
+        default:
+            print_chrome_event(&first, "i", ev->event < PLUGIN_TRACE_EVENT_COUNT ? event_texts[ev->event].format : "event", name, ev->thread, ev->timestamp, origin);
+            printf(",\"s\":\"t\"}");
+            break;
+        }
+    }
+    for(size_t i = 0; i < trackCount; i++){
+        printf("%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",", tracks[i].thread);
+        print_json_string(tracks[i].label);
+        printf("}}");
+        first = 0;
+    }
+    printf("\n]}\n");
+    free(transforms);
+    free(forwards);
+    free(tracks);
+    free(flows);
+}
+
+int main(int argc, char* argv[]){
+    int timestamps = 0;
+    int chrome = 0;
+    const char* path = NULL;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-t") == 0){
+            timestamps = 1;
+        }else if(strcmp(argv[i], "-c") == 0){
+            chrome = 1;
+        }else if(path == NULL && argv[i][0] != '-'){
+            path = argv[i];
+        }else{
+            usage();
+            return 1;
+        }
+    }
+    if(path == NULL){
+        usage();
+        return 1;
+    }
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    char magic[8];
+    if(fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0){
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    char** names = NULL;
+    size_t nameCount = 0;
+    read_event_t* read = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    unsigned long long dropped = 0;
+    trace_event_t record;
+    while(fread(&record, sizeof(record), 1, file) == 1){
+        if(record.event == TRACE_EVENT_SOURCE){
+            size_t len = record.args[0];
+            size_t padded = (len + sizeof(record) - 1) / sizeof(record) * sizeof(record);
+            char* name = calloc(padded + 1, 1);
+            if(name == NULL || fread(name, 1, padded, file) != padded){
+                free(name);
+                break;
+            }
+            name[len] = '\0';
+            if(record.source >= nameCount){
+                char** grown = realloc(names, (record.source + 1) * sizeof(char*));
+                if(grown == NULL){
+                    free(name);
+                    break;
+                }
+                memset(grown + nameCount, 0, (record.source + 1 - nameCount) * sizeof(char*));
+                names = grown;
+                nameCount = record.source + 1;
+            }
+            free(names[record.source]);
+            names[record.source] = name;
+            continue;
+        }
+        if(record.event == TRACE_EVENT_DROPPED){
+            dropped += record.args[0];
+            continue;
+        }
+        if(count == cap){
+            cap = cap ? cap * 2 : 1024;
+            read_event_t* grown = realloc(read, cap * sizeof(read_event_t));
+            if(grown == NULL){
+                break;
+            }
+            read = grown;
+        }
+        read[count].event = record;
+        read[count].index = count;
+        count++;
+    }
+    fclose(file);
+
+    qsort(read, count, sizeof(read_event_t), compare_events);
+    trace_event_t* events = malloc((count > 0 ? count : 1) * sizeof(trace_event_t));
+    if(events == NULL){
+        fprintf(stderr, "Out of memory\n");
+        free(read);
+        return 1;
+    }
+    for(size_t i = 0; i < count; i++){
+        events[i] = read[i].event;
+    }
+    free(read);
+    if(chrome){
+        print_chrome(events, count, names, nameCount);
+        count = 0;
+    }
+    for(size_t i = 0; i < count; i++){
+        const trace_event_t* ev = &events[i];
+        const char* name = ev->source < nameCount && names[ev->source] != NULL ? names[ev->source] : "?";
+        if(timestamps){
+            printf("[%12.3f][%u] ", (ev->timestamp - events[0].timestamp) / 1000.0, ev->thread);
+        }
+        if(ev->event >= PLUGIN_TRACE_EVENT_COUNT){
+            printf("[?][%s] - event %u (%llu, %llu)\n", name, ev->event, (unsigned long long)ev->args[0], (unsigned long long)ev->args[1]);
+            continue;
+        }
+        printf("[%s][%s] - ", event_texts[ev->event].level, name);
+        printf(event_texts[ev->event].format, (unsigned long long)ev->args[0]);
+        printf("\n");
+    }
+    if(dropped > 0){
+        fprintf(stderr, "%llu events were dropped (trace rings full)\n", dropped);
+    }
+    for(size_t i = 0; i < nameCount; i++){
+        free(names[i]);
+    }
+    free(names);
+    free(events);
+    return 0;
+}